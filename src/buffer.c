@@ -13,6 +13,12 @@
 #include "minibuffer.h"
 #include "panel.h"
 #include "isearch.h"
+#include "occur.h"
+#include "grep.h"
+#include "finder.h"
+#include "syntax.h"
+#include "watch.h"
+#include "trace.h"
 
 struct Buffer *curbuf = NULL;
 struct Buffer *prevbuf = NULL;
@@ -20,13 +26,39 @@ struct Buffer *headbuf = NULL;
 
 unsigned buffer_count = 0; /* Includes the minibuffer. */
 
+static void lines_reserve(struct Buffer *buf, int count) {
+    if (count <= buf->lines_cap) return;
+    buf->lines_cap = count*2;
+    buf->lines = reallocate(buf->lines, buf->lines_cap * sizeof(struct Line *));
+}
+
+/* Called once count lines starting at first have been linked in and the
+ * ones after renumbered, before line_count is. */
+static void lines_inserted(struct Line *first, int count) {
+    struct Buffer *buf = first->buf;
+    int y = first->y, i;
+
+    lines_reserve(buf, buf->line_count + count);
+    memmove(buf->lines + y + count, buf->lines + y, (buf->line_count - y) * sizeof(struct Line *));
+    for (i = 0; i < count; i++, first = first->next) buf->lines[y+i] = first;
+}
+
+/* Called once the count lines that were numbered from y are unlinked,
+ * before line_count is. */
+static void lines_removed(struct Buffer *buf, int y, int count) {
+    memmove(buf->lines + y, buf->lines + y + count, (buf->line_count - y - count) * sizeof(struct Line *));
+}
+
 struct Buffer *buffer_allocate(char name[BUF_NAME_LEN]) {
     int i;
     struct Buffer *buf = alloc(1, sizeof(struct Buffer));
     
     strcpy(buf->name, name);
+    get_cwd(buf->directory); /* Until a file is associated, fall back to where we were started. */
     buf->start_line = line_allocate(buf);
     buf->line_count = 1;
+    lines_reserve(buf, 1);
+    buf->lines[0] = buf->start_line;
     buf->view_count = 2;
     buf->curview = 0;
     buf->y = SPACING/2;
@@ -45,6 +77,7 @@ struct Buffer *buffer_allocate(char name[BUF_NAME_LEN]) {
     }
 
     buffer_count++;
+    registry_add(buf);
 
     return buf;
 }
@@ -53,6 +86,15 @@ void buffer_deallocate(struct Buffer *buf) {
     struct Line *line, *next;
     int i;
 
+    registry_remove(buf);
+    isearch_stop_scans(buf);
+    occur_forget(buf);
+    grep_forget(buf);
+    finder_forget(buf);
+    highlight_clear(&buf->highlights);
+    wrap_free(&buf->wrap);
+    dealloc(buf->lines);
+
     for (i = 0; i < buf->view_count; i++) {
         mark_deallocate(buf->views[i].mark);
     }
@@ -63,22 +105,62 @@ void buffer_deallocate(struct Buffer *buf) {
     }
 
     for (i = 0; i < buf->view_count; i++) {
+        dealloc(buf->views[i].search->hits);
         dealloc(buf->views[i].search);
     }
+    dealloc(buf->session);
     dealloc(buf);
 }
 
-static void buffer_draw_point(struct Buffer *buf, bool is_active) {
-    int tab_offset = 0;
-    int i;
-
-    for (i = 0; i < buffer_curr_point(buf)->pos; i++) {
-        if (buffer_curr_point(buf)->line->str[i] == '\t') tab_offset += font_w * (4-1); /* -1 to remove the offset that's already there. */
+/* Every edit goes through here first, since searches on the worker
+ * threads may be reading the lines, and caches are keyed on the version.
+ * y is the first line whose text changes, so the lex states of the lines
+ * after it are stale. */
+static void buffer_will_change(struct Buffer *buf, int y) {
+    if (buf->scans) {
+        isearch_stop_scans(buf);
+        occur_stop_scans(buf);
     }
+    buf->version++;
+    if (y < 0) y = 0;
+    if (y < buf->lex_valid) buf->lex_valid = y;
+    if (y < buf->syntax_valid) buf->syntax_valid = y;
+}
+
+/* Column point is drawn at, with tabs expanded. */
+static int buffer_point_col(struct Buffer *buf) {
+    return line_row_col(buffer_curr_point(buf)->line, buffer_curr_point(buf)->pos);
+}
+
+/* Screen row point is drawn on. */
+static int buffer_point_row(struct Buffer *buf) {
+    return line_row(buffer_curr_point(buf)->line, buffer_curr_point(buf)->pos);
+}
+
+/* Moves point to screen row row. A wrapped point keeps its column in the row. */
+static void buffer_point_to_row(struct Buffer *buf, int row) {
+    struct Point *point = buffer_curr_point(buf);
+    int sub, cols = wrap_cols(buf), col = buffer_point_col(buf);
+
+    if (row >= buffer_row_count(buf)) row = buffer_row_count(buf)-1;
+    point->line = buffer_row_line(buf, row, &sub);
+    if (cols) point->pos = line_byte_at_col(point->line, sub*cols + col);
+}
+
+/* Called before the text of line changes. */
+static void line_will_change(struct Line *line) {
+    buffer_will_change(line->buf, line->y);
+    line->syntax_dirty = true;
+    line->layout_valid = false;
+    dealloc(line->tokens);
+    line->tokens = NULL;
+    wrap_line_changed(line);
+}
 
+static void buffer_draw_point(struct Buffer *buf, bool is_active) {
     const SDL_Rect dst = {
-        tab_offset + buf->x + buffer_curr_scroll(buf)->x + buffer_curr_point(buf)->pos * font_w + strlen(buffer_curr_point(buf)->line->pre_str) * font_w + SPACING,
-        buf->y + buffer_curr_scroll(buf)->y + buffer_curr_point(buf)->line->y * font_h + SPACING * buffer_curr_point(buf)->line->y,
+        buf->x + buffer_curr_scroll(buf)->x + buffer_point_col(buf) * font_w + strlen(buffer_curr_point(buf)->line->pre_str) * font_w + SPACING,
+        buf->y + buffer_curr_scroll(buf)->y + buffer_point_row(buf) * (font_h + SPACING),
         font_w,
         font_h
     };
@@ -99,8 +181,9 @@ static void buffer_draw_point(struct Buffer *buf, bool is_active) {
  */
 void buffer_draw(struct Buffer *buf, int real_view) {
     struct Line *line;
-    int yoff = 0;
-    int amt = 0;
+    int yoff, sub;
+    bool marked = false;
+    Uint32 now = SDL_GetTicks();
     
     /* For the minibuffer, draw a background so text won't be clipping through. */
     if (buf->is_singular) {
@@ -112,9 +195,23 @@ void buffer_draw(struct Buffer *buf, int real_view) {
     if (buffer_curr_mark(buf)->active)
         mark_draw(buffer_curr_mark(buf));
 
-    for (line = buf->start_line; line; line = line->next) {
-        int pos = yoff*SPACING + yoff*font_h;
-        if (pos > -font_h-buffer_curr_scroll(buf)->y && pos < window_height-buffer_curr_scroll(buf)->y) { /* Culling */
+    highlight_update(&buf->highlights, now);
+
+    /* Start from the row just above the screen instead of the top of the buffer. */
+    yoff = -buffer_curr_scroll(buf)->y / (font_h+SPACING) - 1;
+    line = buffer_row_line(buf, yoff, &sub);
+    yoff = line_row(line, 0);
+
+    for (; line; line = line->next) {
+        int pos = yoff*SPACING + yoff*font_h, rows = line_rows(line);
+        if (pos >= window_height-buffer_curr_scroll(buf)->y) break;
+        if (pos + (rows-1)*(font_h+SPACING) > -font_h-buffer_curr_scroll(buf)->y) { /* Culling */
+            if (!marked) {
+                /* Isearch only highlights the matches that are on screen. */
+                isearch_mark_visible(buf, line, window_height/(font_h+SPACING) + 2);
+                syntax_update(buf, line, window_height/(font_h+SPACING) + 2);
+                marked = true;
+            }
             if (line == buffer_curr_point(buf)->line && buf == curbuf && buf != minibuf) { /* Draw a little highlight on current line */
                 if (panel_left == panel_right && real_view != buf->curview) goto after_highlight;
                 
@@ -123,7 +220,7 @@ void buffer_draw(struct Buffer *buf, int real_view) {
                     buf->x + buffer_curr_scroll(buf)->x + SPACING, 
                     buf->y + font_h*yoff + SPACING*yoff + buffer_curr_scroll(buf)->y - SPACING/2,
                     w - buffer_curr_scroll(buf)->x - SPACING*2,
-                    font_h + SPACING
+                    rows * (font_h + SPACING)
                 };
                 SDL_SetRenderDrawColor(renderer, POINT.r, POINT.g, POINT.b, 40);
                 SDL_RenderFillRect(renderer, &r);
@@ -132,18 +229,11 @@ void buffer_draw(struct Buffer *buf, int real_view) {
             
   after_highlight:;
             
-            int i;
-            for (i = 0; i < line->hl_count; i++) {
-                highlight_update(&line->hls[i]);
-                if (line->hls[i].active) {
-                    highlight_draw(line->hls[i], SPACING + buffer_curr_scroll(buf)->x, buf->y + font_h*yoff + SPACING*yoff + buffer_curr_scroll(buf)->y);
-                }
-            }
+            highlight_draw_line(&buf->highlights, line, buf->curview, SPACING + buffer_curr_scroll(buf)->x, buf->y + font_h*yoff + SPACING*yoff + buffer_curr_scroll(buf)->y, now);
 
             line_draw(line, yoff, buffer_curr_scroll(buf)->x, buffer_curr_scroll(buf)->y);
         }
-        amt++;
-        yoff++;
+        yoff += rows;
     }
 
     bool is_active = buf == curbuf;
@@ -161,15 +251,17 @@ void buffer_limit_point(struct Buffer *buf) {
     
     if (buffer_curr_point(buf)->pos < 0) buffer_curr_point(buf)->pos = 0;
     if (buffer_curr_point(buf)->pos > buffer_curr_point(buf)->line->len) buffer_curr_point(buf)->pos = buffer_curr_point(buf)->line->len;
-    if (SPACING + buffer_curr_point(buf)->pos * font_w < -buffer_curr_scroll(buf)->target_x) {
-        buffer_curr_scroll(buf)->target_x = -buffer_curr_point(buf)->pos * font_w;
+    /* Not in the middle of a character. */
+    buffer_curr_point(buf)->pos = line_byte_at_col(buffer_curr_point(buf)->line, line_visual_col(buffer_curr_point(buf)->line, buffer_curr_point(buf)->pos));
+    if (SPACING + buffer_point_col(buf) * font_w < -buffer_curr_scroll(buf)->target_x) {
+        buffer_curr_scroll(buf)->target_x = -buffer_point_col(buf) * font_w;
     }
 }
 
 void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
     static int pclicked = 0;
     
-    if (event->type == SDL_TEXTINPUT) {
+    if (event->type == SDL_TEXTINPUT && !buf->read_only) {
         if (buf->destructive) {
             buf->destructive = false;
             line_delete_chars_range(buf->start_line, 0, buf->start_line->len);
@@ -182,10 +274,11 @@ void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
             mark_delete_text(buffer_curr_mark(buf));
             mark_unset(buffer_curr_mark(buf));
         }
-        line_type(buffer_curr_point(buf)->line, buffer_curr_point(buf)->pos++, *(event->text.text), 1);
+        line_type_string(buffer_curr_point(buf)->line, buffer_curr_point(buf)->pos, event->text.text);
+        buffer_curr_point(buf)->pos += strlen(event->text.text);
         
-        if (SPACING + buffer_curr_point(buf)->pos * font_w > (window_width/panel_count())-buffer_curr_scroll(buf)->target_x) {
-            buffer_curr_scroll(buf)->target_x = -buffer_curr_point(buf)->pos * font_w + (window_width/panel_count()) - font_w - SPACING;
+        if (SPACING + buffer_point_col(buf) * font_w > (window_width/panel_count())-buffer_curr_scroll(buf)->target_x) {
+            buffer_curr_scroll(buf)->target_x = -buffer_point_col(buf) * font_w + (window_width/panel_count()) - font_w - SPACING;
         }
     } else if (event->type == SDL_MOUSEWHEEL) {
         int y = event->wheel.y;
@@ -207,6 +300,10 @@ void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
             }
             case SDLK_RETURN: {
   return_key:
+                if (buf->read_only) {
+                    if (buf->on_return) buf->on_return();
+                    break;
+                }
                 if (buffer_curr_mark(buf)->active) {
                     mark_delete_text(buffer_curr_mark(buf));
                     mark_unset(buffer_curr_mark(buf));
@@ -217,9 +314,9 @@ void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
                 } else {
                     buf->on_return();
                 }
-                int pos = buffer_curr_point(buf)->line->y*SPACING + buffer_curr_point(buf)->line->y*font_h;
+                int pos = buffer_point_row(buf)*SPACING + buffer_point_row(buf)*font_h;
                 if (pos < -font_h-buffer_curr_scroll(buf)->y || pos > window_height-buffer_curr_scroll(buf)->y-font_h*2) {
-                    buffer_curr_scroll(buf)->target_y = -font_h+(window_height-font_h*2)-(SPACING*buffer_curr_point(buf)->line->y + buffer_curr_point(buf)->line->y * font_h);
+                    buffer_curr_scroll(buf)->target_y = -font_h+(window_height-font_h*2)-(SPACING*buffer_point_row(buf) + buffer_point_row(buf) * font_h);
                 }
                 break;
             }
@@ -249,7 +346,7 @@ void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
                         panel_right->curview = 1;
                         if (was_same) panel_left->curview = 0;
                     }
-                } else {
+                } else if (!buf->read_only) {
                     buffer_type_tab(buf);
                 }
                 break;
@@ -295,12 +392,13 @@ void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
 
             case SDLK_l: {
                 if (is_ctrl()) {
-                    buffer_curr_scroll(buf)->target_y = -buffer_curr_point(buf)->line->y * (font_h + SPACING) + window_height/2 - font_h*2;
+                    buffer_curr_scroll(buf)->target_y = -buffer_point_row(buf) * (font_h + SPACING) + window_height/2 - font_h*2;
                 }
                 break;
             }
 
             case SDLK_DELETE: {
+                if (buf->read_only) break;
                 if (is_ctrl()) {
                     struct Point point_prev = *buffer_curr_point(buf);
                     buffer_forward_word(buf);
@@ -330,6 +428,7 @@ void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
                 break;
             }
             case SDLK_BACKSPACE: {
+                if (buf->read_only) break;
                 if (is_ctrl()) {
                     struct Point point_prev = *buffer_curr_point(buf);
                     buffer_backward_word(buf);
@@ -354,8 +453,10 @@ void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
                 if (is_ctrl()) {
                     buffer_backward_word(buf);
                 } else {
-                    buffer_curr_point(buf)->pos--;
-                    if (buffer_curr_point(buf)->pos < 0) {
+                    if (buffer_curr_point(buf)->pos > 0) {
+                        struct Line *line = buffer_curr_point(buf)->line;
+                        buffer_curr_point(buf)->pos = utf8_prev(line->str, line->len, buffer_curr_point(buf)->pos);
+                    } else {
                         if (buffer_curr_point(buf)->line->prev) {
                             buffer_curr_point(buf)->line = buffer_curr_point(buf)->line->prev;
                             buffer_curr_point(buf)->pos = buffer_curr_point(buf)->line->len;
@@ -363,8 +464,8 @@ void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
                     }
                     buffer_limit_point(buf);
                 }
-                if (SPACING + buffer_curr_point(buf)->pos * font_w < -buffer_curr_scroll(buf)->target_x) {
-                    buffer_curr_scroll(buf)->target_x = -buffer_curr_point(buf)->pos * font_w;
+                if (SPACING + buffer_point_col(buf) * font_w < -buffer_curr_scroll(buf)->target_x) {
+                    buffer_curr_scroll(buf)->target_x = -buffer_point_col(buf) * font_w;
                 }
                 break;
             }
@@ -373,16 +474,18 @@ void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
                 if (is_ctrl()) {
                     buffer_forward_word(buf);
                 } else {
-                    buffer_curr_point(buf)->pos++;
-                    if (buffer_curr_point(buf)->pos > buffer_curr_point(buf)->line->len) {
+                    if (buffer_curr_point(buf)->pos < buffer_curr_point(buf)->line->len) {
+                        struct Line *line = buffer_curr_point(buf)->line;
+                        buffer_curr_point(buf)->pos = utf8_next(line->str, line->len, buffer_curr_point(buf)->pos);
+                    } else {
                         if (buffer_curr_point(buf)->line->next) {
                             buffer_curr_point(buf)->line = buffer_curr_point(buf)->line->next;
                             buffer_curr_point(buf)->pos = 0;
                         } else  buffer_curr_point(buf)->pos = buffer_curr_point(buf)->line->len;
                     }
                 }
-                if (SPACING + buffer_curr_point(buf)->pos * font_w > (window_width/panel_count())-buffer_curr_scroll(buf)->target_x) {
-                    buffer_curr_scroll(buf)->target_x = -buffer_curr_point(buf)->pos * font_w;
+                if (SPACING + buffer_point_col(buf) * font_w > (window_width/panel_count())-buffer_curr_scroll(buf)->target_x) {
+                    buffer_curr_scroll(buf)->target_x = -buffer_point_col(buf) * font_w;
                 }
                 break;
             }
@@ -399,9 +502,9 @@ void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
                     buffer_curr_point(buf)->line = buffer_curr_point(buf)->line->prev;
                     buffer_limit_point(buf);
                 }
-                int pos = buffer_curr_point(buf)->line->y*SPACING + buffer_curr_point(buf)->line->y*font_h;
+                int pos = buffer_point_row(buf)*SPACING + buffer_point_row(buf)*font_h;
                 if (pos < -font_h-buffer_curr_scroll(buf)->y || pos > window_height-buffer_curr_scroll(buf)->y) {
-                    buffer_curr_scroll(buf)->target_y = -(SPACING*buffer_curr_point(buf)->line->y + buffer_curr_point(buf)->line->y * font_h);
+                    buffer_curr_scroll(buf)->target_y = -(SPACING*buffer_point_row(buf) + buffer_point_row(buf) * font_h);
                 }
                 break;
             }
@@ -419,9 +522,9 @@ void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
                     buffer_curr_point(buf)->line = buffer_curr_point(buf)->line->next;
                     buffer_limit_point(buf);
                 }
-                int pos = buffer_curr_point(buf)->line->y*SPACING + buffer_curr_point(buf)->line->y*font_h;
+                int pos = buffer_point_row(buf)*SPACING + buffer_point_row(buf)*font_h;
                 if (pos < -font_h-buffer_curr_scroll(buf)->y || pos > window_height-buffer_curr_scroll(buf)->y-font_h*2) {
-                    buffer_curr_scroll(buf)->target_y = -font_h+(window_height-font_h*2)-(SPACING*buffer_curr_point(buf)->line->y + buffer_curr_point(buf)->line->y * font_h);
+                    buffer_curr_scroll(buf)->target_y = -font_h+(window_height-font_h*2)-(SPACING*buffer_point_row(buf) + buffer_point_row(buf) * font_h);
                 }
                 break;
             }
@@ -451,8 +554,8 @@ void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
                             buffer_point_to_end(buf);
                         } else {
                             buffer_curr_point(buf)->pos = buffer_curr_point(buf)->line->len;
-                            if (SPACING + buffer_curr_point(buf)->pos * font_w > (window_width/panel_count())-buffer_curr_scroll(buf)->target_x) {
-                                buffer_curr_scroll(buf)->target_x = -buffer_curr_point(buf)->pos * font_w + (window_width/panel_count()) - font_w - SPACING;
+                            if (SPACING + buffer_point_col(buf) * font_w > (window_width/panel_count())-buffer_curr_scroll(buf)->target_x) {
+                                buffer_curr_scroll(buf)->target_x = -buffer_point_col(buf) * font_w + (window_width/panel_count()) - font_w - SPACING;
                             }
                         }
                         break;
@@ -461,19 +564,15 @@ void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
             }
 
             case SDLK_PAGEDOWN: {
-                int i;
                 buffer_curr_scroll(buf)->target_y -= window_height - font_h * 2;
-                for (i = 0; i < (window_height/(font_h+6)) + 2; i++)
-                    if (buffer_curr_point(buf)->line->next) buffer_curr_point(buf)->line = buffer_curr_point(buf)->line->next;
+                buffer_point_to_row(buf, buffer_point_row(buf) + (window_height/(font_h+6)) + 2);
                 buffer_limit_point(buf);
                 break;
             }
             case SDLK_PAGEUP: {
-                int i;
                 buffer_curr_scroll(buf)->target_y += window_height - font_h * 2;
                 if (buffer_curr_scroll(buf)->target_y > 0) buffer_curr_scroll(buf)->target_y = 0;
-                for (i = 0; i < (window_height/(font_h+6)) + 2; i++)
-                    if (buffer_curr_point(buf)->line->prev) buffer_curr_point(buf)->line = buffer_curr_point(buf)->line->prev;
+                buffer_point_to_row(buf, buffer_point_row(buf) - (window_height/(font_h+6)) - 2);
                 buffer_limit_point(buf);
                 break;
             }
@@ -488,14 +587,14 @@ void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
                 break;
             }
             case SDLK_x: {
-                if (is_ctrl() && buffer_curr_mark(buf)->active) {
+                if (is_ctrl() && buffer_curr_mark(buf)->active && !buf->read_only) {
                     mark_cut_text(buffer_curr_mark(buf));
                     mark_unset(buffer_curr_mark(buf));
                 }
                 break;
             }
             case SDLK_v: {
-                if (is_ctrl()) {
+                if (is_ctrl() && !buf->read_only) {
                     if (buffer_curr_mark(buf)->active) {
                         mark_delete_text(buffer_curr_mark(buf));
                         mark_unset(buffer_curr_mark(buf));
@@ -535,18 +634,17 @@ void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
         int focus_on_right = buf == panel_right;
         if (panel_left == panel_right && buf->curview == 0) focus_on_right = 0;
         
-        int x = mx + SPACING;
+        int x = mx - SPACING - curbuf_scroll->target_x + font_w/2;
         if (focus_on_right) x -= window_width/2;
         x /= font_w;
-        x--;
         if (x < 0) x = 0;
         
-        int y = (event->button.y - curbuf_scroll->target_y)/(font_h+SPACING);
+        int y = (event->button.y - curbuf_scroll->target_y)/(font_h+SPACING), sub;
+        int cols = wrap_cols(buf);
 
-        buffer_curr_point(buf)->pos = x;
-        for (buffer_curr_point(buf)->line = buf->start_line; 
-             buffer_curr_point(buf)->line && buffer_curr_point(buf)->line->y < y;
-             buffer_curr_point(buf)->line = buffer_curr_point(buf)->line->next);
+        buffer_curr_point(buf)->line = buffer_row_line(buf, y, &sub);
+        if (cols) x = sub*cols + (x < cols ? x : cols-1);
+        buffer_curr_point(buf)->pos = line_byte_at_col(buffer_curr_point(buf)->line, x);
         
         buffer_limit_point(buf);
         
@@ -560,7 +658,9 @@ void buffer_handle_input(struct Buffer *buf, SDL_Event *event) {
 
 void buffer_backspace(struct Buffer *buf) {
     if (buffer_curr_point(buf)->pos > 0) {
-        line_delete_char(buffer_curr_point(buf)->line, --buffer_curr_point(buf)->pos);
+        struct Line *line = buffer_curr_point(buf)->line;
+        buffer_curr_point(buf)->pos = utf8_prev(line->str, line->len, buffer_curr_point(buf)->pos);
+        line_delete_char(line, buffer_curr_point(buf)->pos);
     } else if (buffer_curr_point(buf)->line != buf->start_line) {
         struct Line *prev;
         /* Get line content, move to end of previous line, and delete old line. */
@@ -576,12 +676,76 @@ void buffer_backspace(struct Buffer *buf) {
     }
 }
 
+/* Where p ends up once the text between start and end is deleted. */
+static void region_fix_point(struct Point *p, struct Point start, struct Point end) {
+    if (!p->line || p->line->y < start.line->y || p->line->y > end.line->y) return;
+    if (p->line == start.line && p->pos <= start.pos) return;
+
+    if (p->line == end.line && p->pos >= end.pos) {
+        p->pos = start.pos + p->pos - end.pos;
+    } else {
+        p->pos = start.pos;
+    }
+    p->line = start.line;
+}
+
+/* Deletes the text between start and end, which must be in order, and
+ * leaves point at start. The lines in between are unlinked in one go and
+ * the ones after renumbered once, so this is linear in the region. */
+void buffer_delete_region(struct Buffer *buf, struct Point start, struct Point end) {
+    struct Line *line, *next, *after;
+    int i, removed = 0;
+
+    line_will_change(start.line);
+
+    for (i = 0; i < buf->view_count; i++) {
+        region_fix_point(&buf->views[i].point, start, end);
+    }
+
+    if (start.line == end.line) {
+        line_delete_chars_range(start.line, start.pos, end.pos);
+    } else {
+        int tail = end.line->len - end.pos;
+        int len = start.pos + tail;
+
+        /* Join the start of the first line with the end of the last. */
+        if (len >= start.line->cap) {
+            while (len >= start.line->cap) start.line->cap *= 2;
+            start.line->str = reallocate(start.line->str, start.line->cap * sizeof(char));
+        }
+        memcpy(start.line->str + start.pos, end.line->str + end.pos, tail);
+        memset(start.line->str + len, 0, start.line->cap - len);
+        start.line->len = len;
+
+        next = end.line->next;
+        for (line = start.line->next; line != next; line = after) {
+            after = line->next;
+            line_deallocate(line);
+            removed++;
+        }
+        start.line->next = next;
+        if (next) next->prev = start.line;
+        for (line = next; line; line = line->next) {
+            line->y -= removed;
+        }
+        lines_removed(buf, start.line->y+1, removed);
+        buf->line_count -= removed;
+        wrap_lines_removed(buf, start.line->y+1, removed);
+        line_update_texture(start.line);
+    }
+
+    *buffer_curr_point(buf) = start;
+    buffer_set_edited(buf, true);
+}
+
 void buffer_newline(struct Buffer *buf) {
     if (buf->is_singular) return;
+    buffer_will_change(buf, buffer_curr_point(buf)->line->y);
     
     struct Point *point = buffer_curr_point(buf);
+    struct Line *added;
     if (!point->line->next) {
-        point->line->next = line_allocate(buf);
+        point->line->next = added = line_allocate(buf);
         point->line->next->y = point->line->y+1;
         point->line->next->prev = point->line;
         if (point->pos == point->line->len) {
@@ -597,18 +761,19 @@ void buffer_newline(struct Buffer *buf) {
         struct Line *new_line, *old_next;
     
         old_next = point->line->next;
-        new_line = line_allocate(buf);
-    
-        line_type_string(new_line, 0, point->line->str + point->pos);
-        int amt_chars_deleted = point->line->len - point->pos;
-        line_delete_chars_range(point->line, point->pos, point->line->len);
+        new_line = added = line_allocate(buf);
     
+        /* Numbered and linked in first, so typing into it only invalidates from here. */
         new_line->y = old_next->y;
         point->line->next = new_line;
         new_line->next = old_next;
         old_next->prev = new_line;
         new_line->prev = point->line;
     
+        line_type_string(new_line, 0, point->line->str + point->pos);
+        int amt_chars_deleted = point->line->len - point->pos;
+        line_delete_chars_range(point->line, point->pos, point->line->len);
+    
         point->line = point->line->next;
         if (amt_chars_deleted > 0) {
             point->pos = 0;
@@ -623,48 +788,118 @@ void buffer_newline(struct Buffer *buf) {
         }
     }
     buffer_set_edited(buf, true);
+    lines_inserted(added, 1);
     buf->line_count++;
+    wrap_lines_inserted(added, 1);
 }
 
-/* Pastes text at point. */
-void buffer_paste_text(struct Buffer *buf) {
-    char *clipboard = SDL_GetClipboardText();
-    char *text = clipboard;
-
-    while (*text) {
-        if (*text == '\r' || *text == '\n') {
-            buffer_newline(buf);
-            if (*text == '\r' && *(text+1) == '\n') {
-                text += 2;
-            } else {
-                text++;
-            }
-            continue;
+/* Length of the line break at text, if there is one. Unless any_newline
+ * is set only \n counts, so files keep their \r's. */
+static int line_break_length(const char *text, const char *end, bool any_newline) {
+    if (*text == '\n') return 1;
+    if (!any_newline || *text != '\r') return 0;
+    return text+1 < end && text[1] == '\n' ? 2 : 1;
+}
+
+/* Appends len bytes of str to the end of line, without re-rendering it. */
+static void line_append(struct Line *line, const char *str, int len) {
+    if (line->len + len >= line->cap) {
+        while (line->len + len >= line->cap) line->cap *= 2;
+        line->str = reallocate(line->str, line->cap * sizeof(char));
+    }
+    memcpy(line->str + line->len, str, len);
+    line->len += len;
+    memset(line->str + line->len, 0, line->cap - line->len);
+}
+
+/* Inserts len bytes of text at point, leaving point after it. The text is
+ * split into lines in one scan and the new lines linked in at once, so
+ * only the line point was on is re-rendered; the new ones are rendered
+ * when they're first drawn. Singular buffers get the lines joined. */
+void buffer_insert_text(struct Buffer *buf, const char *text, int len, bool any_newline) {
+    struct Point *point = buffer_curr_point(buf);
+    struct Line *first = point->line, *last = first, *rest = first->next, *line;
+    const char *end = text + len, *p, *seg;
+    char *tail;
+    int tail_len, added = 0, i;
+
+    line_will_change(first);
+
+    /* The first line keeps what's before point, the last one gets what's after. */
+    tail_len = first->len - point->pos;
+    tail = alloc(tail_len+1, sizeof(char));
+    memcpy(tail, first->str + point->pos, tail_len);
+    first->len = point->pos;
+
+    for (p = seg = text; p < end; p++) {
+        int brk = line_break_length(p, end, any_newline);
+        if (!brk) continue;
+
+        line_append(last, seg, p - seg);
+        if (!buf->is_singular) {
+            line = line_allocate(buf);
+            line->prev = last;
+            last->next = line;
+            line->y = last->y+1;
+            last = line;
+            added++;
         }
-        line_type(buffer_curr_point(buf)->line, buffer_curr_point(buf)->pos++, *text, 0);
-        text++;
+        p += brk-1;
+        seg = p+1;
     }
+    line_append(last, seg, end - seg);
 
-    struct Line *line;
-    for (line = buf->start_line; line; line = line->next) {
-        line_update_texture(line);
+    for (i = 0; i < buf->view_count; i++) {
+        struct Point *other = &buf->views[i].point;
+        if (other == point || other->line != first || other->pos < point->pos) continue;
+        other->line = last;
+        other->pos = last->len + other->pos - point->pos;
     }
-     
-    int y = SPACING*buffer_curr_point(buf)->line->y + buffer_curr_point(buf)->line->y * font_h;
+    point->line = last;
+    point->pos = last->len;
+
+    line_append(last, tail, tail_len);
+    dealloc(tail);
+
+    /* Link the rest of the buffer back in after the new lines. */
+    last->next = rest;
+    if (rest) rest->prev = last;
+    if (added) {
+        for (line = rest; line; line = line->next) {
+            line->y += added;
+        }
+    }
+
+    if (added) lines_inserted(first->next, added);
+    buf->line_count += added;
+    if (added) wrap_lines_inserted(first->next, added);
+    buffer_set_edited(buf, true);
+    line_update_texture(first);
+}
+
+/* Pastes text at point. */
+void buffer_paste_text(struct Buffer *buf) {
+    char *clipboard = SDL_GetClipboardText();
+
+    buffer_insert_text(buf, clipboard, strlen(clipboard), true);
+
+    int y = SPACING*buffer_point_row(buf) + buffer_point_row(buf) * font_h;
     if (y < -buffer_curr_scroll(buf)->target_y || y > window_height-font_h*2-buffer_curr_scroll(buf)->target_y) { 
         buffer_curr_scroll(buf)->target_y = -font_h+window_height-font_h*2-y;
     }
-    if (SPACING + buffer_curr_point(buf)->pos * font_w > window_width-buffer_curr_scroll(buf)->target_x) {
-        buffer_curr_scroll(buf)->target_x = -buffer_curr_point(buf)->pos * font_w + window_width - font_w - SPACING;
+    if (SPACING + buffer_point_col(buf) * font_w > window_width-buffer_curr_scroll(buf)->target_x) {
+        buffer_curr_scroll(buf)->target_x = -buffer_point_col(buf) * font_w + window_width - font_w - SPACING;
     }
 
     SDL_free(clipboard);
 }
 
 void buffer_save(struct Buffer *buf) {
-    FILE *fp = fopen(buf->filename, "w");
-
+    FILE *fp;
     struct Line *line;
+
+    trace_begin("buffer_save");
+    fp = fopen(buf->filename, "w");
     for (line = buf->start_line; line; line = line->next) {
         fputs(line->str, fp); 
         fputs("\n", fp);
@@ -672,68 +907,90 @@ void buffer_save(struct Buffer *buf) {
 
     fclose(fp);
     buffer_set_edited(buf, false);
+    watch_remember(buf);
+    trace_end();
 }
 
-int buffer_load_file(struct Buffer *buf, char *file) {
+/* Reads the whole file into a string, which loading and reloading both
+ * split into lines. A trailing newline ends the last line rather than
+ * starting a new one, so it's left out of len. NULL if it can't be read. */
+char *buffer_read_file(const char *file, int *len) {
     FILE *fp = fopen(file, "r");
-    char directory[256] = {0};
-
-    if (!fp) {
-        return 1;
-    }
-
-    char absolute_path[BUF_NAME_LEN] = {0};
-    _fullpath(absolute_path, file, BUF_NAME_LEN);
+    char *text;
+    long size;
 
-    strcpy(buf->filename, absolute_path); /* Use the absolute path for the stored directory. */
-    remove_directory(buf->name, file);
+    if (!fp) return NULL;
 
-    isolate_directory(directory, file);
-    chdir(directory);
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
 
-    int total_len = 0, total_cap = 2048;
-    char *total_string = alloc(total_cap, sizeof(char));
+    text = alloc(size+1, sizeof(char));
+    size = fread(text, 1, size, fp);
+    fclose(fp);
 
-    char line[1024] = {0};
-    while (fgets(line, sizeof(line), fp)) {
-        int i;
-        int len = strlen(line);
-        for (i = 0; i < len; i++) {
-            if (line[i] == '\n') continue;
-            line_type(buffer_curr_point(buf)->line, buffer_curr_point(buf)->pos++, line[i], 0);
-        }
-        int line_len = buffer_curr_point(buf)->line->len;
+    if (size && text[size-1] == '\n') size--;
+    text[size] = 0;
+    *len = size;
+    return text;
+}
 
-        buffer_newline(buf);
+int buffer_load_file(struct Buffer *buf, char *file) {
+    char *text;
+    int len, i;
 
-        total_len += line_len+1;
-        if (total_len >= total_cap) {
-            total_cap *= 2;
-            total_string = realloc(total_string, total_cap);
-        }
-        strcat(total_string, line);
+    trace_begin("buffer_load_file");
+    text = buffer_read_file(file, &len);
+    if (!text) {
+        trace_end();
+        return 1;
     }
 
-    buf->indent_mode = determine_tabs_indent_method(total_string);
+    buffer_set_filename(buf, file);
 
-    free(total_string);
+    buf->indent_mode = determine_tabs_indent_method(text);
+    buffer_insert_text(buf, text, len, false);
 
-    fclose(fp);
+    dealloc(text);
 
-    /* We'll update the texture when it's in view and if texture==NULL. */
+    buffer_set_edited(buf, false);
+    watch_remember(buf);
 
-    /* Remove the extra newline generated from the while loop. */
-    if (line_is_empty(buffer_curr_point(buf)->line)) {
-        line_remove(buffer_curr_point(buf)->line);
-        buffer_curr_point(buf)->line = buffer_curr_point(buf)->line->prev;
+    /* Every view, since inserting moved the other one along with point. */
+    for (i = 0; i < buf->view_count; i++) {
+        buf->views[i].point.line = buf->start_line;
+        buf->views[i].point.pos = 0;
     }
 
-    buffer_set_edited(buf, false);
+    trace_end();
+    return 0;
+}
 
-    buffer_curr_point(buf)->line = buf->start_line;
-    buffer_curr_point(buf)->pos = 0;
+/* Associates the buffer with a file, storing its absolute path, and the
+ * directory it's in so we never have to chdir() into it. */
+void buffer_set_filename(struct Buffer *buf, char *file) {
+    char absolute_path[BUF_NAME_LEN] = {0};
+    _fullpath(absolute_path, file, BUF_NAME_LEN);
 
-    return 0;
+    strcpy(buf->filename, absolute_path);
+    remove_directory(buf->name, absolute_path);
+
+    memset(buf->directory, 0, BUF_NAME_LEN);
+    isolate_directory(buf->directory, absolute_path);
+    registry_update(buf);
+
+    if (syntax_for_file(absolute_path) != buf->syntax) {
+        struct Line *line;
+        buf->syntax = syntax_for_file(absolute_path);
+        buf->syntax_valid = 0;
+        for (line = buf->start_line; line; line = line->next) {
+            line->syntax_dirty = true;
+            dealloc(line->tokens);
+            line->tokens = NULL;
+            if (line->main_texture) SDL_DestroyTexture(line->main_texture);
+            line->main_texture = NULL;
+        }
+    }
 }
 
 void buffer_set_edited(struct Buffer *buf, bool edited) {
@@ -754,6 +1011,37 @@ void buffer_set_edited(struct Buffer *buf, bool edited) {
     }
 }
 
+/* Removes every line, leaving one empty line behind. */
+void buffer_clear(struct Buffer *buf) {
+    struct Line *line, *next;
+    int i;
+
+    highlight_clear(&buf->highlights);
+    for (line = buf->start_line->next; line; line = next) {
+        next = line->next;
+        line_deallocate(line);
+    }
+    buf->start_line->next = NULL;
+    buf->line_count = 1;
+    buf->lines[0] = buf->start_line;
+    wrap_lines_changed(buf);
+    line_set_string(buf->start_line, "", 0);
+
+    for (i = 0; i < buf->view_count; i++) {
+        mark_unset(buf->views[i].mark);
+        isearch_invalidate(buf->views[i].search);
+        buf->views[i].point.line = buf->start_line;
+        buf->views[i].point.pos = 0;
+        buf->views[i].scroll.target_y = 0;
+        buf->views[i].scroll.target_x = 0;
+    }
+}
+
+/* Returns the open buffer visiting the file at absolute_path, if any. */
+struct Buffer *buffer_find_file(char *absolute_path) {
+    return registry_find_file(absolute_path);
+}
+
 void buffer_reset_completion(struct Buffer *buf) {
     buf->is_completing = false;
     buf->completion = 0;
@@ -795,46 +1083,61 @@ void buffer_debug(struct Buffer *buf) {
 }
 
 void buffer_goto_line(struct Buffer *buf, int line) {
-    for (buffer_curr_point(buf)->line = buf->start_line; buffer_curr_point(buf)->line; buffer_curr_point(buf)->line = buffer_curr_point(buf)->line->next) {
-        if (buffer_curr_point(buf)->line->y == line) break;
-    }
+    buffer_curr_point(buf)->line = buffer_line_at(buf, line);
     buffer_curr_point(buf)->pos = 0;
 }
 
-/* Find current {} level, then add that amount of tabs at current line. */
-void buffer_auto_indent(struct Buffer *buf) {
-    struct Line *line;
-    int indent = 0,
-        char_quote = 0,
-        string_quote = 0, 
-        multi_comment = 0, 
-        single_comment = 0;
-    
-    for (line = buf->start_line; line != buffer_curr_point(buf)->line; line = line->next) {
-        int i;
-        for (i = 0; i < line->len; i++) {
-            if (line->str[i] == '/' && i < line->len-1 && line->str[i+1] == '*') multi_comment = 1;
-            if (line->str[i] == '*' && i < line->len-1 && line->str[i+1] == '/') multi_comment = 0;
-            if (line->str[i] == '/' && i < line->len-1 && line->str[i+1] == '/') single_comment = 1;
-                
-            if (multi_comment || single_comment) continue;
-            
-            if (line->str[i] == '\'' && ((i > 0 && line->str[i-1] != '\\') || (i == 0))) {
-                if (!string_quote) char_quote = !char_quote;
-            } else if (line->str[i] == '\"' && ((i > 0 && line->str[i-1] != '\\') || (i == 0))) {
-                if (!char_quote) string_quote = !string_quote;
-            }
-            
-            if (char_quote || string_quote) continue;
+/* Line number y, or the first or last line if it's out of range. */
+struct Line *buffer_line_at(struct Buffer *buf, int y) {
+    if (y < 0) y = 0;
+    if (y >= buf->line_count) y = buf->line_count-1;
+    return buf->lines[y];
+}
+
+/* Advances the auto-indenter's scan over line. */
+static void lex_line(struct LexState *state, struct Line *line) {
+    int i, single_comment = 0;
+    for (i = 0; i < line->len; i++) {
+        if (line->str[i] == '/' && i < line->len-1 && line->str[i+1] == '*') state->multi_comment = 1;
+        if (line->str[i] == '*' && i < line->len-1 && line->str[i+1] == '/') state->multi_comment = 0;
+        if (line->str[i] == '/' && i < line->len-1 && line->str[i+1] == '/') single_comment = 1;
             
-            if (line->str[i] == '{') indent++;
-            if (line->str[i] == '}') indent--;
+        if (state->multi_comment || single_comment) continue;
+        
+        if (line->str[i] == '\'' && ((i > 0 && line->str[i-1] != '\\') || (i == 0))) {
+            if (!state->string_quote) state->char_quote = !state->char_quote;
+        } else if (line->str[i] == '\"' && ((i > 0 && line->str[i-1] != '\\') || (i == 0))) {
+            if (!state->char_quote) state->string_quote = !state->string_quote;
         }
-        single_comment = 0;
+        
+        if (state->char_quote || state->string_quote) continue;
+        
+        if (line->str[i] == '{') state->indent++;
+        if (line->str[i] == '}') state->indent--;
     }
+}
 
+/* Indents point's line by the brace depth at its start. Each line caches
+ * the scan's state at its start, so this only scans from the last line
+ * that hasn't been edited since. */
+void buffer_auto_indent(struct Buffer *buf) {
+    struct Line *target = buffer_curr_point(buf)->line, *line;
+    struct LexState state;
     int i;
-    for (i = 0; i < indent; i++) {
+
+    for (line = target; line->y > buf->lex_valid && line->prev; line = line->prev);
+    if (line == buf->start_line) {
+        memset(&line->lex, 0, sizeof(struct LexState));
+    }
+
+    state = line->lex;
+    for (; line != target; line = line->next) {
+        lex_line(&state, line);
+        line->next->lex = state;
+    }
+    buf->lex_valid = target->y;
+
+    for (i = 0; i < state.indent; i++) {
         buffer_type_tab(buf);
     }
 }
@@ -928,8 +1231,8 @@ void buffer_point_to_end(struct Buffer *buf) {
         buffer_curr_point(buf)->line = buffer_curr_point(buf)->line->next;
     }
     buffer_curr_point(buf)->pos = buffer_curr_point(buf)->line->len;
-    if (SPACING*buffer_curr_point(buf)->line->y + buffer_curr_point(buf)->line->y * font_h > window_height - font_h*2 - buffer_curr_scroll(buf)->y) {
-        buffer_curr_scroll(buf)->target_y = -font_h+(window_height-font_h*2)-(SPACING*buffer_curr_point(buf)->line->y + buffer_curr_point(buf)->line->y * font_h);
+    if (SPACING*buffer_point_row(buf) + buffer_point_row(buf) * font_h > window_height - font_h*2 - buffer_curr_scroll(buf)->y) {
+        buffer_curr_scroll(buf)->target_y = -font_h+(window_height-font_h*2)-(SPACING*buffer_point_row(buf) + buffer_point_row(buf) * font_h);
     }
 }
 
@@ -939,10 +1242,15 @@ struct Line *line_allocate(struct Buffer *buf) {
     line->cap = 16;
     line->str = alloc(line->cap, sizeof(char));
     line->pre_texture = line->main_texture = NULL;
+    line->syntax_dirty = true;
     return line;
 }
 
 void line_deallocate(struct Line *line) {
+    if (line->buf->highlights.count) highlight_forget_line(&line->buf->highlights, line);
+    wrap_forget_line(line);
+    dealloc(line->layout);
+    dealloc(line->tokens);
     if (line->main_texture) SDL_DestroyTexture(line->main_texture);
     if (line->pre_texture) SDL_DestroyTexture(line->pre_texture);
     dealloc(line->str);
@@ -951,6 +1259,9 @@ void line_deallocate(struct Line *line) {
 
 void line_remove(struct Line *line) {
     struct Line *l;
+    int i;
+
+    buffer_will_change(line->buf, line->y-1);
 
     if (line == line->buf->start_line) {
         line->buf->start_line = line->next;
@@ -962,20 +1273,61 @@ void line_remove(struct Line *line) {
         }
     }
 
-    for (l = line->buf->start_line; l; l = l->next) {
-        int prev = -1;
-        if (l->prev) prev = l->prev->y;
-        l->y = prev+1;
+    for (l = line->next; l; l = l->next) {
+        l->y--;
+    }
+
+    /* Points of other views can't be left on it. */
+    for (i = 0; i < line->buf->view_count; i++) {
+        struct Point *point = &line->buf->views[i].point;
+        if (point->line != line) continue;
+        point->line = line->prev ? line->prev : line->next;
+        point->pos = line->prev ? line->prev->len : 0;
     }
 
+    lines_removed(line->buf, line->y, 1);
     line->buf->line_count--;
+    wrap_lines_removed(line->buf, line->y, 1);
     line_deallocate(line);
 }
 
+/* Links a new line holding str in after prev. It's rendered once it's drawn. */
+struct Line *line_insert_after(struct Line *prev, const char *str, int len) {
+    struct Buffer *buf = prev->buf;
+    struct Line *line = line_allocate(buf), *l;
+
+    buffer_will_change(buf, prev->y);
+
+    if (len >= line->cap) {
+        while (len >= line->cap) line->cap *= 2;
+        dealloc(line->str);
+        line->str = alloc(line->cap, sizeof(char));
+    }
+    memcpy(line->str, str, len);
+    line->len = len;
+
+    line->prev = prev;
+    line->next = prev->next;
+    if (prev->next) prev->next->prev = line;
+    prev->next = line;
+
+    line->y = prev->y+1;
+    for (l = line->next; l; l = l->next) {
+        l->y++;
+    }
+    lines_inserted(line, 1);
+    buf->line_count++;
+    wrap_lines_inserted(line, 1);
+    buffer_set_edited(buf, true);
+    return line;
+}
+
 void line_type(struct Line *line, int pos, char c, int update) {
     /* Shift everything from pos to len, then insert c. */
     int i;
 
+    line_will_change(line);
+
     for (i = line->len-1; i >= pos; i--) {
         line->str[i+1] = line->str[i];
     }
@@ -987,7 +1339,7 @@ void line_type(struct Line *line, int pos, char c, int update) {
         int j;
 
         line->cap *= 2;
-        line->str = realloc(line->str, line->cap * sizeof(char));
+        line->str = reallocate(line->str, line->cap * sizeof(char));
 
         /* Zero-out the newly allocated region. */
         for (j = line->len; j < line->cap; j++) {
@@ -1006,27 +1358,262 @@ void line_type_string(struct Line *line, int pos, char *str) {
     line_update_texture(line);
 }
 
-void line_delete_char(struct Line *line, int pos) {
-    int i;
-    for (i = pos; i <= line->len; i++) {
-        line->str[i] = line->str[i+1];
+/* Replaces the whole contents of the line, only re-rendering it once. */
+void line_set_string(struct Line *line, const char *str, int len) {
+    line_will_change(line);
+    if (len >= line->cap) {
+        while (len >= line->cap) line->cap *= 2;
+        line->str = reallocate(line->str, line->cap * sizeof(char));
     }
-    line->str[--line->len] = 0;
-    /* Perhaps allocate a smaller space if len <= 1/2 cap? */
+    memcpy(line->str, str, len);
+    memset(line->str + len, 0, line->cap - len);
+    line->len = len;
+    buffer_set_edited(line->buf, true);
     line_update_texture(line);
 }
 
+/* Deletes the character starting at pos, which may be several bytes. */
+void line_delete_char(struct Line *line, int pos) {
+    if (pos < 0 || pos >= line->len) return;
+    line_delete_chars_range(line, pos, utf8_next(line->str, line->len, pos));
+}
+
 void line_delete_chars_range(struct Line *line, int start, int end) {
-    int count = end-start;
-    while (count) {
-        line_delete_char(line, start);
-        count--;
+    int count;
+
+    if (end > line->len) end = line->len;
+    if (start >= end) return;
+    count = end-start;
+
+    line_will_change(line);
+    memmove(line->str + start, line->str + end, line->len - end);
+    line->len -= count;
+    memset(line->str + line->len, 0, count);
+    line_update_texture(line);
+}
+
+/* Indexes the characters that aren't one byte in one column, tabs and
+ * multi-byte UTF-8, with how many characters and tabs come before each.
+ * Columns and bytes line up one to one between them, so either can be
+ * found from the other by binary search. */
+static void line_build_layout(struct Line *line) {
+    int i, chars = 0, tabs = 0;
+
+    line->layout_count = 0;
+    for (i = 0; i < line->len; i = utf8_next(line->str, line->len, i), chars++) {
+        if (line->str[i] != '\t' && utf8_char_len(line->str, line->len, i) == 1) continue;
+        if (line->layout_count == line->layout_cap) {
+            line->layout_cap = line->layout_cap ? line->layout_cap*2 : 8;
+            line->layout = reallocate(line->layout, line->layout_cap * sizeof(struct LayoutChar));
+        }
+        line->layout[line->layout_count].pos = i;
+        line->layout[line->layout_count].chars = chars;
+        line->layout[line->layout_count].tabs = tabs;
+        line->layout_count++;
+        if (line->str[i] == '\t') tabs++;
+    }
+    line->layout_valid = true;
+}
+
+/* Column the indexed character c starts at. */
+static int layout_col(struct LayoutChar *c) {
+    return c->chars + c->tabs * (tab_width-1);
+}
+
+/* Where the indexed character c ends, in bytes and columns. */
+static void line_layout_end(struct Line *line, struct LayoutChar *c, int *pos, int *col) {
+    bool tab = line->str[c->pos] == '\t';
+    *pos = c->pos + (tab ? 1 : utf8_char_len(line->str, line->len, c->pos));
+    *col = layout_col(c) + (tab ? tab_width : 1);
+}
+
+/* Column that byte pos is drawn at, with each tab taking tab_width
+ * columns and every other character one. */
+int line_visual_col(struct Line *line, int pos) {
+    int lo = 0, hi, end_pos, end_col;
+
+    if (!line->layout_valid) line_build_layout(line);
+
+    /* Indexed characters starting before pos. */
+    hi = line->layout_count;
+    while (lo < hi) {
+        int mid = lo + (hi-lo)/2;
+        if (line->layout[mid].pos < pos) lo = mid+1;
+        else hi = mid;
+    }
+    if (lo == 0) return pos;
+    line_layout_end(line, &line->layout[lo-1], &end_pos, &end_col);
+    if (pos < end_pos) return layout_col(&line->layout[lo-1]); /* Inside a character. */
+    return end_col + pos - end_pos;
+}
+
+/* Byte starting the character drawn at column col, or len if it's past the end. */
+int line_byte_at_col(struct Line *line, int col) {
+    int lo = 0, hi, pos, end_pos, end_col;
+
+    if (!line->layout_valid) line_build_layout(line);
+
+    /* Indexed characters starting at or before col. */
+    hi = line->layout_count;
+    while (lo < hi) {
+        int mid = lo + (hi-lo)/2;
+        if (layout_col(&line->layout[mid]) <= col) lo = mid+1;
+        else hi = mid;
+    }
+    if (lo == 0) {
+        pos = col;
+    } else {
+        line_layout_end(line, &line->layout[lo-1], &end_pos, &end_col);
+        if (col < end_col) return line->layout[lo-1].pos;
+        pos = end_pos + col - end_col;
+    }
+    return pos > line->len ? line->len : pos;
+}
+
+/* Recolors the white text in surf, a column per character. Rendering the
+ * line once and tinting it beats a surface for every colored run. */
+static void line_color_surface(SDL_Surface *surf, const unsigned char *tokens, int len) {
+    int x, y, col;
+
+    if (SDL_MUSTLOCK(surf)) SDL_LockSurface(surf);
+    for (col = 0; col < len; col++) {
+        SDL_Color c = token_colors[tokens[col]];
+        Uint32 rgb, amask = surf->format->Amask;
+        int x_end = (col+1) * font_w;
+
+        if (tokens[col] == TOKEN_TEXT) continue;
+        rgb = SDL_MapRGBA(surf->format, c.r, c.g, c.b, 0) & ~amask;
+        if (col == len-1 || x_end > surf->w) x_end = surf->w;
+        for (y = 0; y < surf->h; y++) {
+            Uint32 *row = (Uint32 *)((Uint8 *)surf->pixels + y * surf->pitch);
+            for (x = col * font_w; x < x_end; x++) {
+                row[x] = (row[x] & amask) | rgb;
+            }
+        }
+    }
+    if (SDL_MUSTLOCK(surf)) SDL_UnlockSurface(surf);
+}
+
+/* Columns of line a view scrolled to scroll_x shows, clamped to the line. */
+static void line_visible_cols(struct Line *line, int scroll_x, int *first, int *last) {
+    int width = line_visual_col(line, line->len);
+
+    *first = (-scroll_x - line->pre_texture_w) / font_w;
+    *last = *first + (window_width / panel_count()) / font_w + 2;
+    if (*first < 0) *first = 0;
+    if (*first > width) *first = width;
+    if (*last > width) *last = width;
+}
+
+/* Most columns a sliced texture covers. When wrapping it's whole rows. */
+static int line_slice_max(int cols) {
+    int max = LINE_TEXTURE_MAX_W / font_w;
+    if (cols) max = max < cols ? cols : max - max % cols;
+    return max;
+}
+
+/* Columns to render for line: all of them if it fits in a texture,
+ * otherwise the visible ones with half a screen to either side, so the
+ * slice is only rendered again after scrolling that far sideways. A
+ * wrapped line starts at the point's row if it has the point, and the
+ * rest is rendered when drawn. */
+static void line_slice_cols(struct Line *line, int scroll_x, int *first, int *last) {
+    int width = line_visual_col(line, line->len);
+    int margin = (window_width / panel_count()) / font_w / 2 + 1;
+    int cols = wrap_cols(line->buf);
+
+    if (width * font_w <= LINE_TEXTURE_MAX_W) {
+        *first = 0;
+        *last = width;
+        return;
+    }
+    if (cols) {
+        struct Point *point = buffer_curr_point(line->buf);
+        *first = point->line == line ? line_visual_col(line, point->pos) / cols * cols : 0;
+        *last = *first + line_slice_max(cols);
+        if (*last > width) *last = width;
+        return;
+    }
+    line_visible_cols(line, scroll_x, first, last);
+    *first -= margin;
+    *last += margin;
+    if (*first < 0) *first = 0;
+    if (*last > width) *last = width;
+    if (*first >= *last) *first = *last > 0 ? *last-1 : 0;
+}
+
+/* Renders columns [first_col, last_col) of line into its main texture. */
+static void line_render_cols(struct Line *line, int first_col, int last_col) {
+    SDL_Color col = (SDL_Color){255, 255, 255, 255};
+    if (line->buf->destructive) {
+        col.a = 127;
+    }
+
+    int begin = 0, end = line->len;
+    bool sliced = false;
+    if (first_col > 0 || last_col < line_visual_col(line, line->len)) {
+        begin = line_byte_at_col(line, first_col);
+        end = line_byte_at_col(line, last_col);
+        if (end < line->len && line_visual_col(line, end) < last_col) end++; /* The rest of a tab. */
+        sliced = true;
+    }
+
+    /* Convert tabs to spaces before rendering, and bytes that aren't
+     * UTF-8 to '?' so they still take up one column. */
+    int i, next, len = 0, cols = 0;
+    char *draw_string = alloc((end-begin) * tab_width + 1, sizeof(char)); /* Allocating the most needed. */
+    unsigned char *tokens = NULL, *draw_tokens = NULL;
+
+    if (line->buf->syntax && !line->buf->destructive) {
+        /* The lexer has to start at the beginning of the line, so a
+         * sliced line keeps its tokens for the next slice. */
+        tokens = line->tokens;
+        if (!tokens) {
+            tokens = alloc(line->len, sizeof(unsigned char));
+            syntax_lex(line->buf->syntax, line->str, line->len, line->syntax_start, tokens);
+            if (sliced) line->tokens = tokens;
+        }
+        draw_tokens = alloc((end-begin) * tab_width, sizeof(unsigned char));
+    }
+    for (i = begin; i < end; i = next) {
+        int n = utf8_char_len(line->str, line->len, i);
+        int w = line->str[i] == '\t' ? tab_width : 1;
+        next = i + n;
+        if (line->str[i] == '\t') {
+            memset(draw_string + len, ' ', w);
+            len += w;
+        } else if (n == 1 && (unsigned char)line->str[i] >= 0x80) {
+            draw_string[len++] = '?';
+        } else {
+            memcpy(draw_string + len, line->str + i, n);
+            len += n;
+        }
+        if (tokens) memset(draw_tokens + cols, tokens[i], w);
+        cols += w;
+    }
+    line->main_texture_col = line_visual_col(line, begin);
+    line->main_texture_cols = cols;
+
+    SDL_Surface *surf = TTF_RenderUTF8_Blended(font, draw_string, col);
+    if (tokens) {
+        line_color_surface(surf, draw_tokens, cols);
+        if (tokens != line->tokens) dealloc(tokens);
+        dealloc(draw_tokens);
     }
+    if (line->main_texture) SDL_DestroyTexture(line->main_texture);
+
+    line->main_texture = SDL_CreateTextureFromSurface(renderer, surf);
+    line->main_texture_w = surf->w;
+    line->main_texture_h = surf->h;
+
+    dealloc(draw_string);
+    SDL_FreeSurface(surf);
 }
 
 void line_update_texture(struct Line *line) {
+    trace_begin("line_update_texture");
     if (strlen(line->pre_str)) {
-        SDL_Surface *pre_surf = TTF_RenderText_Blended(font, line->pre_str, (SDL_Color){88, 98, 237, 255});
+        SDL_Surface *pre_surf = TTF_RenderUTF8_Blended(font, line->pre_str, (SDL_Color){88, 98, 237, 255});
         if (line->pre_texture) SDL_DestroyTexture(line->pre_texture);
         line->pre_texture = SDL_CreateTextureFromSurface(renderer, pre_surf);
         line->pre_texture_w = pre_surf->w;
@@ -1035,31 +1622,45 @@ void line_update_texture(struct Line *line) {
     }
 
     if (line->len > 0) {
-        SDL_Color col = (SDL_Color){255, 255, 255, 255};
-        if (line->buf->destructive) {
-            col.a = 127;
-        }
+        /* Long lines only get the columns around what's on screen. */
+        int first_col, last_col;
+        line_slice_cols(line, buffer_curr_scroll(line->buf)->x, &first_col, &last_col);
+        line_render_cols(line, first_col, last_col);
+    }
+    trace_end();
+}
 
-        /* Convert tabs to spaces before rendering. */
-        int i;
-        char *draw_string = alloc(line->len * 4 + 1, sizeof(char)); /* Allocating the most needed. */
-        for (i = 0; i < line->len; i++) {
-            if (line->str[i] == '\t') {
-                strcat(draw_string, "    ");
-            } else {
-                strcat(draw_string, (char[2]){line->str[i], 0});
-            }
-        }
+/* Draws a wrapped line a row at a time, each row being the next cols
+ * columns of the texture. */
+static void line_draw_wrapped(struct Line *line, int yoff, int scroll_x, int scroll_y, int cols) {
+    int width = line_visual_col(line, line->len), rows = line_rows(line), r;
 
-        SDL_Surface *surf = TTF_RenderText_Blended(font, draw_string, col);
-        if (line->main_texture) SDL_DestroyTexture(line->main_texture);
+    for (r = 0; r < rows; r++) {
+        int first_col = r * cols, last_col = first_col + cols < width ? first_col + cols : width;
+        int pos = (yoff + r) * (font_h + SPACING);
 
-        line->main_texture = SDL_CreateTextureFromSurface(renderer, surf);
-        line->main_texture_w = surf->w;
-        line->main_texture_h = surf->h;
+        if (first_col >= last_col) break;
+        if (pos <= -font_h-scroll_y || pos >= window_height-scroll_y) continue; /* Culling */
 
-        dealloc(draw_string);
-        SDL_FreeSurface(surf);
+        if (!line->main_texture ||
+            first_col < line->main_texture_col ||
+            last_col > line->main_texture_col + line->main_texture_cols) {
+            int end = first_col + line_slice_max(cols);
+            line_render_cols(line, first_col, end < width ? end : width);
+        }
+        const SDL_Rect src = {
+            (first_col - line->main_texture_col) * font_w,
+            0,
+            (last_col - first_col) * font_w,
+            line->main_texture_h
+        };
+        const SDL_Rect dst = {
+            line->buf->x + scroll_x + SPACING,
+            line->buf->y + scroll_y + pos,
+            src.w,
+            src.h
+        };
+        SDL_RenderCopy(renderer, line->main_texture, &src, &dst);
     }
 }
 
@@ -1077,10 +1678,18 @@ void line_draw(struct Line *line, int yoff, int scroll_x, int scroll_y) {
         SDL_RenderCopy(renderer, line->pre_texture, NULL, &dst);
     }
 
-    if (line->len > 0) {
-        if (!line->main_texture) line_update_texture(line);
+    if (line->len > 0 && wrap_cols(line->buf)) {
+        line_draw_wrapped(line, yoff, scroll_x, scroll_y, wrap_cols(line->buf));
+    } else if (line->len > 0) {
+        int first_col, last_col;
+        line_visible_cols(line, scroll_x, &first_col, &last_col);
+        if (!line->main_texture ||
+            first_col < line->main_texture_col ||
+            last_col > line->main_texture_col + line->main_texture_cols) {
+            line_update_texture(line);
+        }
         const SDL_Rect dst = (SDL_Rect){
-            line->buf->x + scroll_x + SPACING + line->pre_texture_w,
+            line->buf->x + scroll_x + SPACING + line->pre_texture_w + line->main_texture_col * font_w,
             line->buf->y + scroll_y + yoff * SPACING + yoff * font_h,
             line->main_texture_w, 
             line->main_texture_h
@@ -1105,7 +1714,7 @@ void line_debug(struct Line *line) {
 bool line_is_empty(struct Line *line) {
     char *c = line->str;
     while (*c) {
-        if (!isspace(*c))
+        if (!isspace((unsigned char)*c))
             return false;
         ++c;
     }
@@ -3,11 +3,15 @@
 
 #define BUF_NAME_LEN 256
 #define SPACING 4
+#define LINE_TEXTURE_MAX_W 4096 /* Lines wider than this are rendered a slice at a time. */
 
 #include <stdbool.h>
+#include <time.h>
 #include <SDL2/SDL.h>
 
 #include "highlight.h"
+#include "wrap.h"
+#include "registry.h"
 
 extern struct Buffer *headbuf, *curbuf, *prevbuf;
 extern unsigned buffer_count; /* Includes the minibuffer. */
@@ -36,6 +40,8 @@ struct Buffer {
 
     char name[BUF_NAME_LEN];
     char filename[BUF_NAME_LEN];
+    char directory[BUF_NAME_LEN]; /* Resolved directory of the buffer, ending in a slash. 
+                                     Relative paths typed in the minibuffer resolve against this. */
 
     int indent_mode;         /* 1 is tab, 0 is spaces. */
 
@@ -47,7 +53,24 @@ struct Buffer {
         
     struct Line *start_line; /* Doubly linked list of lines */
     int line_count;
+    struct Line **lines;     /* The lines by number, kept up to date with the list. */
+    int lines_cap;
     bool edited;             /* Flag to show if buffer is edited */
+    time_t file_mtime;       /* The file as of the last load, save or reload, to notice other programs changing it. */
+    long file_size;
+    unsigned long file_dev, file_ino; /* Which file it is, whatever path it was opened by. 0 if it isn't on disk. */
+    int registry_keys;       /* Bits for the registry tables it's in, chained through these. */
+    struct Buffer *registry_next[REGISTRY_KEYS];
+    unsigned registry_hash[REGISTRY_KEYS];
+    struct SessionView *session; /* Where the views were, while a buffer restored from the session hasn't read its file. */
+    bool read_only;          /* Typing doesn't edit it, eg. *occur*. RETURN calls on_return. */
+    unsigned version;        /* Bumped on every edit, so caches can tell when they're stale. */
+    int scans;               /* Searches reading the buffer on the worker threads. */
+    int lex_valid;           /* Lines up to this one have an up to date lex state. */
+    const struct Syntax *syntax; /* How it's highlighted, or NULL for plain text. */
+    int syntax_valid;        /* Lines before this one have up to date syntax states. */
+    struct HighlightStore highlights;
+    struct WrapLayout wrap;  /* Screen rows of the lines when soft wrapping. */
 
     bool is_completing;            /* Did we just hit tab to complete? Used to cycle through completions. */
     int completion;                /* Amount of cycles into the completion. */
@@ -57,7 +80,7 @@ struct Buffer {
     bool is_singular;        /* Singular means a special buffer where there's only one line, 
                                 and something important happens at RETURN. */
     int singular_state;      /* The state of the one-lined special buffer (minibuffer.) */
-    int (*on_return)();      /* Function that executes once at RETURN if is_singular=true */
+    int (*on_return)();      /* Function that executes once at RETURN if is_singular or read_only */
 };
 
 struct Buffer *buffer_allocate(char name[BUF_NAME_LEN]);
@@ -67,15 +90,22 @@ void           buffer_limit_point(struct Buffer *buf);
 void           buffer_handle_input(struct Buffer *buf, SDL_Event *event);
 void           buffer_newline(struct Buffer *buf);
 void           buffer_paste_text(struct Buffer *buf);
+void           buffer_insert_text(struct Buffer *buf, const char *text, int len, bool any_newline);
 void           buffer_save(struct Buffer *buf);
 int            buffer_load_file(struct Buffer *buf, char *file);
+char          *buffer_read_file(const char *file, int *len);
+void           buffer_set_filename(struct Buffer *buf, char *file);
 void           buffer_set_edited(struct Buffer *buf, bool edited);
+void           buffer_clear(struct Buffer *buf);
+struct Buffer *buffer_find_file(char *absolute_path);
 void           buffer_debug(struct Buffer *buf);
 void           buffer_backspace(struct Buffer *buf);
+void           buffer_delete_region(struct Buffer *buf, struct Point start, struct Point end);
 void           buffer_reset_completion(struct Buffer *buf);
 void           buffer_kill(struct Buffer *buf);
 bool           buffer_is_scrolling(struct Buffer *buf);
 void           buffer_goto_line(struct Buffer *buf, int line);
+struct Line   *buffer_line_at(struct Buffer *buf, int y);
 void           buffer_auto_indent(struct Buffer *buf);
 void           buffer_type_tab(struct Buffer *buf);
 void           buffer_remove_tab(struct Buffer *buf);
@@ -91,35 +121,60 @@ void buffer_backward_word(struct Buffer *buf);
 void buffer_point_to_beginning(struct Buffer *buf);
 void buffer_point_to_end(struct Buffer *buf);
 
+/* What auto-indent's scan knows at the start of a line. */
+struct LexState {
+    int indent;              /* Brace depth. */
+    bool char_quote, string_quote, multi_comment;
+};
+
+/* A character in a line that isn't one byte drawn in one column. */
+struct LayoutChar {
+    int pos;
+    int chars, tabs;           /* Characters and tabs before it. */
+};
+
 struct Line {
     struct Line *prev;
     struct Line *next;
 
     struct Buffer *buf;        /* Buffer the line belongs to */
     int y;                     /* Line number */
+    struct LexState lex;       /* Valid if y <= buf->lex_valid. */
+    unsigned char syntax_start, syntax_end; /* The highlighter's state at the start and end. */
+    bool syntax_dirty;         /* Edited since syntax_end was worked out. */
+    unsigned char *tokens;     /* Every byte's token, kept while the line is rendered in slices. */
+
+    struct LayoutChar *layout; /* Tabs and multi-byte characters, built when a column is first needed. */
+    int layout_count, layout_cap;
+    bool layout_valid;
+    int wrap_rows, wrap_cols;  /* Rows the line takes when wrapped at wrap_cols, or 0 if not worked out. */
+    bool wrap_queued;          /* Waiting for its row count to be updated in buf->wrap. */
+    int wrap_slot;             /* Where it is in the queue, if so. */
 
     char *str;                 /* Dynamically allocated array of chars */
     int len, cap;
 
     char pre_str[256];         /* String that displays before the main string. 
                                   Used in minibuffer for prompts. */
-    struct Highlight hls[255]; /* A highlight, used in search. */
-    int hl_count;              /* Amount of highlights in the line. */
-
     SDL_Texture *pre_texture, *main_texture;
     int pre_texture_w, pre_texture_h;
     int main_texture_w, main_texture_h;
+    int main_texture_col, main_texture_cols; /* Columns main_texture covers. */
 };
 
 struct Line *line_allocate(struct Buffer *buf);
 void         line_deallocate(struct Line *line);
 void         line_remove(struct Line *line);
+struct Line *line_insert_after(struct Line *prev, const char *str, int len);
 void         line_type(struct Line *line, int pos, char c, int update);
 void         line_type_string(struct Line *line, int pos, char *str);
+void         line_set_string(struct Line *line, const char *str, int len);
 void         line_delete_char(struct Line *line, int pos);
 void         line_delete_chars_range(struct Line *line, int start, int end);
 void         line_draw(struct Line *line, int yoff, int x_scroll, int y_scroll);
 void         line_update_texture(struct Line *line);
+int          line_visual_col(struct Line *line, int pos);
+int          line_byte_at_col(struct Line *line, int col);
 void         line_debug(struct Line *line);
 bool         line_is_empty(struct Line *line);
 
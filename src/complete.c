@@ -0,0 +1,169 @@
+#include "complete.h"
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "fuzzy.h"
+#include "util.h"
+
+struct CompleteMatch {
+    int name;                /* Index in the list it came from. */
+    int score;
+};
+
+static struct DirListing cache[COMPLETE_CACHE_DIRS];
+static unsigned cache_clock = 0;
+static struct NameList buffer_names;
+
+/* The ranking TAB cycles through, and the list its names are in. */
+static struct NameList *matched_list = NULL;
+static struct CompleteMatch *matches = NULL;
+static int match_count = 0, match_cap = 0;
+
+static void names_add(struct NameList *list, const char *name) {
+    int len = strlen(name)+1;
+
+    if (list->text_len + len > list->text_cap) {
+        list->text_cap = list->text_cap*2 > list->text_len + len ? list->text_cap*2 : list->text_len + len + 256;
+        list->text = reallocate(list->text, list->text_cap);
+    }
+    if (list->count == list->cap) {
+        list->cap = list->cap ? list->cap*2 : 64;
+        list->names = reallocate(list->names, list->cap * sizeof(int));
+    }
+    memcpy(list->text + list->text_len, name, len);
+    list->names[list->count++] = list->text_len;
+    list->text_len += len;
+}
+
+static void names_clear(struct NameList *list) {
+    list->text_len = 0;
+    list->count = 0;
+}
+
+static void names_free(struct NameList *list) {
+    dealloc(list->text);
+    dealloc(list->names);
+    memset(list, 0, sizeof(*list));
+}
+
+static const char *sort_text;
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(sort_text + *(const int *)a, sort_text + *(const int *)b);
+}
+
+/* Best score first, then in the list's order. */
+static int compare_matches(const void *a, const void *b) {
+    const struct CompleteMatch *x = a, *y = b;
+    if (x->score != y->score) return y->score - x->score;
+    return x->name - y->name;
+}
+
+/* The sorted listing of dirname, from the cache if it hasn't changed. */
+static struct DirListing *complete_list_dir(const char *dirname) {
+    struct DirListing *dir = NULL;
+    struct dirent *entry;
+    struct stat st;
+    DIR *d;
+    int i;
+
+    if (strlen(dirname) >= BUF_NAME_LEN || stat(dirname, &st) != 0) return NULL;
+
+    for (i = 0; i < COMPLETE_CACHE_DIRS; i++) {
+        if (cache[i].used && 0 == strcmp(cache[i].path, dirname)) {
+            dir = &cache[i];
+            break;
+        }
+    }
+    if (dir && dir->mtime == st.st_mtime) {
+        dir->used = ++cache_clock;
+        return dir;
+    }
+    if (!dir) {
+        dir = &cache[0];
+        for (i = 1; i < COMPLETE_CACHE_DIRS; i++) {
+            if (cache[i].used < dir->used) dir = &cache[i];
+        }
+    }
+
+    d = opendir(dirname);
+    if (!d) return NULL;
+
+    strcpy(dir->path, dirname);
+    dir->mtime = st.st_mtime;
+    dir->used = ++cache_clock;
+    names_clear(&dir->list);
+    while ((entry = readdir(d)) != NULL) {
+        if (0==strcmp(entry->d_name, ".") || 0==strcmp(entry->d_name, "..")) continue;
+        names_add(&dir->list, entry->d_name);
+    }
+    closedir(d);
+
+    sort_text = dir->list.text;
+    qsort(dir->list.names, dir->list.count, sizeof(int), compare_names);
+    return dir;
+}
+
+/* Ranks the names in list that match query, best first. */
+static int complete_rank(struct NameList *list, const char *query) {
+    int i, query_len = strlen(query);
+
+    if (list->count > match_cap) {
+        match_cap = list->count;
+        dealloc(matches);
+        matches = alloc(match_cap, sizeof(struct CompleteMatch));
+    }
+    match_count = 0;
+    for (i = 0; i < list->count; i++) {
+        const char *name = list->text + list->names[i];
+        int score = fuzzy_score(query, query_len, name, strlen(name));
+        if (score == FUZZY_NO_MATCH) continue;
+        matches[match_count].name = i;
+        matches[match_count].score = score;
+        match_count++;
+    }
+    if (query_len) qsort(matches, match_count, sizeof(struct CompleteMatch), compare_matches);
+    matched_list = list;
+    return match_count;
+}
+
+/* Ranks the entries of dirname against query. Returns how many matched. */
+int complete_files(const char *dirname, const char *query) {
+    struct DirListing *dir = complete_list_dir(dirname);
+    match_count = 0;
+    matched_list = NULL;
+    if (!dir) return 0;
+    return complete_rank(&dir->list, query);
+}
+
+/* Ranks the names of the open buffers against query, leaving out skip. */
+int complete_buffers(const char *query, struct Buffer *skip) {
+    struct Buffer *buf;
+
+    names_clear(&buffer_names);
+    for (buf = headbuf; buf; buf = buf->next) {
+        if (buf != skip) names_add(&buffer_names, buf->name);
+    }
+    return complete_rank(&buffer_names, query);
+}
+
+/* The ith best match of the last ranking. */
+char *complete_match(int i) {
+    return matched_list->text + matched_list->names[matches[i].name];
+}
+
+void complete_free() {
+    int i;
+    for (i = 0; i < COMPLETE_CACHE_DIRS; i++) {
+        names_free(&cache[i].list);
+        cache[i].used = 0;
+    }
+    names_free(&buffer_names);
+    dealloc(matches);
+    matches = NULL;
+    match_count = match_cap = 0;
+    matched_list = NULL;
+}
@@ -0,0 +1,36 @@
+#ifndef COMPLETE_H_
+#define COMPLETE_H_
+
+/* Candidates for TAB in the minibuffer. Directory listings are cached,
+   sorted, for the last few directories, and read again only when the
+   directory's modification time changes. A query ranks the names it
+   fuzzy matches best first, once, and TAB then cycles through that
+   ranking without looking at the directory again. */
+
+#include <time.h>
+
+#include "buffer.h"
+
+#define COMPLETE_CACHE_DIRS 8
+
+/* Names packed one after another, each ending in 0. */
+struct NameList {
+    char *text;
+    int text_len, text_cap;
+    int *names;              /* Where each name starts in text. */
+    int count, cap;
+};
+
+struct DirListing {
+    char path[BUF_NAME_LEN];
+    time_t mtime;            /* Of the directory when it was read. */
+    unsigned used;           /* When it was last completed in, to evict the oldest. */
+    struct NameList list;
+};
+
+int         complete_files(const char *dirname, const char *query);
+int         complete_buffers(const char *query, struct Buffer *skip);
+char       *complete_match(int i);
+void        complete_free();
+
+#endif /* COMPLETE_H_ */
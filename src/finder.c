@@ -0,0 +1,596 @@
+#include "finder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "globals.h"
+#include "util.h"
+#include "trace.h"
+#include "panel.h"
+#include "jobs.h"
+#include "fuzzy.h"
+#include "session.h"
+
+#define lower(c) ((c) >= 'A' && (c) <= 'Z' ? (c) - 'A' + 'a' : (c))
+
+struct FinderMatch {
+    int path, score, len;
+};
+
+static struct FinderIndex *finder = NULL;
+static struct Buffer *files_buf = NULL;
+
+static char query[BUF_NAME_LEN] = {0};
+static int q_len = 0;
+static unsigned q_mask = 0;
+static bool ranked = false;              /* The ranking for query finished, */
+static bool ranking = false;             /* or is part way through. */
+static int rank_next, rank_old, rank_first_new, rank_end;
+static unsigned rank_removals = 0;
+static int ranked_count = 0;             /* Paths in the index when it was ranked. */
+static int *matches = NULL;              /* Every path query matched, in index order. */
+static int match_count = 0, match_cap = 0;
+static struct FinderMatch top[FINDER_SHOWN]; /* The best, worst on top. */
+static int top_count = 0;
+static Uint32 last_rank = 0;
+
+static void finder_rank(const char *q);
+
+static unsigned char_mask(char c) {
+    c = lower(c);
+    if (c >= 'a' && c <= 'z') return 1u << (c - 'a');
+    if (c >= '0' && c <= '9') return 1u << 26;
+    switch (c) {
+        case '.': return 1u << 27;
+        case '_': return 1u << 28;
+        case '-': return 1u << 29;
+        case '/': return 1u << 30;
+    }
+    return 1u << 31;
+}
+
+static void int_push(int **arr, int *count, int *cap, int value) {
+    if (*count == *cap) {
+        *cap = *cap ? *cap*2 : 8;
+        *arr = reallocate(*arr, *cap * sizeof(int));
+    }
+    (*arr)[(*count)++] = value;
+}
+
+/* Only wakes the main loop if there isn't a wakeup on its way already. */
+static void finder_notify(struct FinderIndex *f) {
+    if (SDL_AtomicCAS(&f->notified, 0, 1)) jobs_notify();
+}
+
+static int finder_add_dir(struct FinderIndex *f, const char *path) {
+    struct FinderDir *d;
+
+    if (f->dir_count == f->dir_cap) {
+        f->dir_cap = f->dir_cap ? f->dir_cap*2 : 64;
+        f->dirs = reallocate(f->dirs, f->dir_cap * sizeof(struct FinderDir));
+    }
+    d = &f->dirs[f->dir_count];
+    memset(d, 0, sizeof(struct FinderDir));
+    d->path = alloc(strlen(path)+1, sizeof(char));
+    strcpy(d->path, path);
+    return f->dir_count++;
+}
+
+/* Takes the paths of files out of the index. Called with the lock held. */
+static void finder_remove_files(struct FinderIndex *f, int *files, int count) {
+    int i;
+    for (i = 0; i < count; i++) {
+        f->paths[files[i]].len = -1;
+    }
+    f->dead += count;
+    if (count) f->removals++;
+}
+
+/* Drops directory i and everything under it. */
+static void finder_kill_dir(struct FinderIndex *f, int i) {
+    int j;
+
+    SDL_LockMutex(f->lock);
+    finder_remove_files(f, f->dirs[i].files, f->dirs[i].file_count);
+    SDL_UnlockMutex(f->lock);
+    f->dirs[i].file_count = 0;
+
+    for (j = 0; j < f->dirs[i].dir_count; j++) {
+        finder_kill_dir(f, f->dirs[i].dirs[j]);
+    }
+    f->dirs[i].dir_count = 0;
+    f->dirs[i].dead = true;
+}
+
+/* Reads directory i (again). Its files replace the ones it had, new
+ * subdirectories are read in turn, and ones that are gone are dropped.
+ * Hidden files and directories, like .git, are skipped. */
+static void finder_read_dir(struct FinderIndex *f, int i) {
+    char full[BUF_NAME_LEN], relative[BUF_NAME_LEN];
+    char *names = NULL;                  /* Files found, packed, added under one lock. */
+    int names_len = 0, names_cap = 0;
+    int *name_starts = NULL, name_count = 0, name_cap = 0;
+    int *found = NULL, found_count = 0, found_cap = 0; /* Subdirectories there now, */
+    int *fresh = NULL, fresh_count = 0, fresh_cap = 0; /* and the ones that weren't before. */
+    int old_dirs = f->dirs[i].dir_count, j;
+    struct dirent *ent;
+    struct stat st;
+    DIR *d;
+
+    sprintf(full, "%s%s", f->root, f->dirs[i].path);
+    if (stat(full, &st) != 0 || !(d = opendir(full))) {
+        finder_kill_dir(f, i);
+        return;
+    }
+    /* Changes later in the same second wouldn't change the time, so a
+     * directory read in the second it changed is read again next time. */
+    f->dirs[i].mtime = st.st_mtime == time(NULL) ? 0 : st.st_mtime;
+
+    while ((ent = readdir(d)) != NULL && !SDL_AtomicGet(&f->cancel)) {
+        if (ent->d_name[0] == '.') continue;
+        if (strlen(f->root) + strlen(f->dirs[i].path) + strlen(ent->d_name) + 2 > BUF_NAME_LEN) continue;
+
+        sprintf(relative, "%s%s", f->dirs[i].path, ent->d_name);
+        sprintf(full, "%s%s", f->root, relative);
+        if (stat(full, &st) != 0) continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            strcat(relative, "/");
+            for (j = 0; j < old_dirs; j++) {
+                if (0 == strcmp(f->dirs[f->dirs[i].dirs[j]].path, relative)) break;
+            }
+            if (j < old_dirs) {
+                int_push(&found, &found_count, &found_cap, f->dirs[i].dirs[j]);
+            } else {
+                int child = finder_add_dir(f, relative);
+                int_push(&found, &found_count, &found_cap, child);
+                int_push(&fresh, &fresh_count, &fresh_cap, child);
+            }
+        } else if (S_ISREG(st.st_mode)) {
+            int len = strlen(relative)+1;
+            if (names_len + len > names_cap) {
+                names_cap = names_cap*2 > names_len + len ? names_cap*2 : names_len + len + 1024;
+                names = reallocate(names, names_cap);
+            }
+            memcpy(names + names_len, relative, len);
+            int_push(&name_starts, &name_count, &name_cap, names_len);
+            names_len += len;
+        }
+    }
+    closedir(d);
+
+    /* Subdirectories that weren't found again are gone. */
+    for (j = 0; j < old_dirs; j++) {
+        int k, child = f->dirs[i].dirs[j];
+        for (k = 0; k < found_count && found[k] != child; k++);
+        if (k == found_count) finder_kill_dir(f, child);
+    }
+    f->dirs[i].dir_count = 0;
+    for (j = 0; j < found_count; j++) {
+        int_push(&f->dirs[i].dirs, &f->dirs[i].dir_count, &f->dirs[i].dir_cap, found[j]);
+    }
+
+    SDL_LockMutex(f->lock);
+    finder_remove_files(f, f->dirs[i].files, f->dirs[i].file_count);
+    f->dirs[i].file_count = 0;
+    if (f->text_len + names_len > f->text_cap) {
+        f->text_cap = f->text_cap*2 > f->text_len + names_len ? f->text_cap*2 : f->text_len + names_len + 65536;
+        f->text = reallocate(f->text, f->text_cap);
+    }
+    for (j = 0; j < name_count; j++) {
+        struct FinderPath *p;
+        const char *name = names + name_starts[j], *c;
+
+        if (f->count == f->cap) {
+            f->cap = f->cap ? f->cap*2 : 1024;
+            f->paths = reallocate(f->paths, f->cap * sizeof(struct FinderPath));
+        }
+        p = &f->paths[f->count];
+        p->text = f->text_len;
+        p->len = strlen(name);
+        p->name = strlen(f->dirs[i].path);
+        p->mask = 0;
+        for (c = name; *c; c++) p->mask |= char_mask(*c);
+        memcpy(f->text + f->text_len, name, p->len+1);
+        f->text_len += p->len+1;
+        int_push(&f->dirs[i].files, &f->dirs[i].file_count, &f->dirs[i].file_cap, f->count);
+        f->count++;
+    }
+    SDL_UnlockMutex(f->lock);
+    finder_notify(f);
+
+    dealloc(names);
+    dealloc(name_starts);
+    dealloc(found);
+
+    for (j = 0; j < fresh_count && !SDL_AtomicGet(&f->cancel); j++) {
+        finder_read_dir(f, fresh[j]);
+    }
+    dealloc(fresh);
+}
+
+/* Packs the paths that are still there together once most are gone. */
+static void finder_compact(struct FinderIndex *f) {
+    char *text;
+    struct FinderPath *paths;
+    int *moved, i, j, count = 0, text_len = 0;
+
+    SDL_LockMutex(f->lock);
+    text = alloc(f->text_cap, sizeof(char));
+    paths = alloc(f->cap, sizeof(struct FinderPath));
+    moved = alloc(f->count ? f->count : 1, sizeof(int));
+    for (i = 0; i < f->count; i++) {
+        struct FinderPath *p = &f->paths[i];
+        if (p->len < 0) continue;
+        paths[count] = *p;
+        paths[count].text = text_len;
+        memcpy(text + text_len, f->text + p->text, p->len+1);
+        text_len += p->len+1;
+        moved[i] = count++;
+    }
+    for (i = 0; i < f->dir_count; i++) {
+        for (j = 0; j < f->dirs[i].file_count; j++) {
+            f->dirs[i].files[j] = moved[f->dirs[i].files[j]];
+        }
+    }
+    dealloc(f->text);
+    dealloc(f->paths);
+    dealloc(moved);
+    f->text = text;
+    f->paths = paths;
+    f->text_len = text_len;
+    f->count = count;
+    f->dead = 0;
+    f->removals++;
+    SDL_UnlockMutex(f->lock);
+}
+
+/* Reads the directories whose modification time changed. Parents come
+ * before their children, so a directory that's gone is usually dropped
+ * with its parent before it's looked at. */
+static void finder_refresh(struct FinderIndex *f) {
+    int i, count = f->dir_count;
+    struct stat st;
+    char full[BUF_NAME_LEN];
+
+    for (i = 0; i < count && !SDL_AtomicGet(&f->cancel); i++) {
+        if (f->dirs[i].dead) continue;
+        sprintf(full, "%s%s", f->root, f->dirs[i].path);
+        if (stat(full, &st) != 0)                 finder_kill_dir(f, i);
+        else if (st.st_mtime != f->dirs[i].mtime) finder_read_dir(f, i);
+    }
+    if (f->dead > f->count/2) finder_compact(f);
+}
+
+static void finder_run(void *data) {
+    struct FinderIndex *f = data;
+
+    if (f->dir_count == 0) {
+        finder_add_dir(f, "");
+        finder_read_dir(f, 0);
+    } else {
+        finder_refresh(f);
+    }
+
+    /* f may be freed as soon as running is cleared. */
+    SDL_AtomicSet(&f->notified, 1);
+    SDL_AtomicSet(&f->running, 0);
+    jobs_notify();
+}
+
+static void finder_start(struct FinderIndex *f) {
+    SDL_AtomicSet(&f->running, 1);
+    jobs_submit(f, finder_run, f);
+}
+
+static void finder_free() {
+    int i;
+
+    SDL_AtomicSet(&finder->cancel, 1);
+    if (jobs_remove_group(finder)) SDL_AtomicSet(&finder->running, 0);
+    while (SDL_AtomicGet(&finder->running)) SDL_Delay(1);
+
+    for (i = 0; i < finder->dir_count; i++) {
+        dealloc(finder->dirs[i].path);
+        dealloc(finder->dirs[i].files);
+        dealloc(finder->dirs[i].dirs);
+    }
+    dealloc(finder->dirs);
+    dealloc(finder->text);
+    dealloc(finder->paths);
+    SDL_DestroyMutex(finder->lock);
+    dealloc(finder);
+    finder = NULL;
+    ranked = ranking = false;
+}
+
+/* The nearest directory up from buf's with a .git in it, or buf's own. */
+static void finder_root(struct Buffer *buf, char *root) {
+    char dir[BUF_NAME_LEN], git[BUF_NAME_LEN+8];
+    struct stat st;
+    int len;
+
+    strcpy(dir, buf->directory);
+    len = strlen(dir);
+    if (len && dir[len-1] != '/' && dir[len-1] != '\\' && len < BUF_NAME_LEN-1) strcat(dir, "/");
+    strcpy(root, dir);
+
+    for (;;) {
+        sprintf(git, "%s.git", dir);
+        if (stat(git, &st) == 0) {
+            strcpy(root, dir);
+            return;
+        }
+        /* Up one, keeping the slash before the last component. */
+        len = strlen(dir) - 1;
+        while (len > 0 && dir[len-1] != '/' && dir[len-1] != '\\') len--;
+        if (len <= 0) return;
+        dir[len] = 0;
+    }
+}
+
+static bool finder_better(const struct FinderMatch *a, const struct FinderMatch *b) {
+    if (a->score != b->score) return a->score > b->score;
+    if (a->len != b->len)     return a->len < b->len;
+    return a->path < b->path;
+}
+
+static int compare_matches(const void *a, const void *b) {
+    if (finder_better(a, b)) return -1;
+    return finder_better(b, a) ? 1 : 0;
+}
+
+/* Keeps m if it's among the FINDER_SHOWN best so far. */
+static void top_offer(struct FinderMatch m) {
+    int i = top_count, child;
+
+    if (top_count < FINDER_SHOWN) {
+        /* Up while better than the parent, so the worst stays on top. */
+        for (top_count++; i > 0 && finder_better(&top[(i-1)/2], &m); i = (i-1)/2) top[i] = top[(i-1)/2];
+        top[i] = m;
+        return;
+    }
+    if (!finder_better(&m, &top[0])) return;
+    for (i = 0; (child = i*2+1) < top_count; i = child) {
+        if (child+1 < top_count && finder_better(&top[child], &top[child+1])) child++;
+        if (!finder_better(&m, &top[child])) break;
+        top[i] = top[child];
+    }
+    top[i] = m;
+}
+
+/* Matching in the file name beats matching across the directories. */
+static int finder_score(const char *q, int q_len, const char *path, struct FinderPath *p) {
+    if (!memchr(q, '/', q_len)) {
+        int score = fuzzy_score(q, q_len, path + p->name, p->len - p->name);
+        if (score != FUZZY_NO_MATCH) return score + FINDER_NAME_BONUS;
+    }
+    return fuzzy_score(q, q_len, path, p->len);
+}
+
+/* Lists the best matches so far in *files*. Called with the lock held,
+ * so the paths can't move. */
+static void finder_show() {
+    struct FinderMatch sorted[FINDER_SHOWN];
+    char header[BUF_NAME_LEN*2];
+    struct Line *tail;
+    int i;
+
+    memcpy(sorted, top, top_count * sizeof(struct FinderMatch));
+    qsort(sorted, top_count, sizeof(struct FinderMatch), compare_matches);
+
+    buffer_clear(files_buf);
+    sprintf(header, "%d of %d files under %s%s", match_count, finder->count - finder->dead, finder->root,
+            SDL_AtomicGet(&finder->running) ? " (indexing...)" : ranking ? " (ranking...)" : "");
+    line_set_string(files_buf->start_line, header, strlen(header));
+    for (i = 0, tail = files_buf->start_line; i < top_count; i++) {
+        struct FinderPath *p = &finder->paths[sorted[i].path];
+        tail = line_insert_after(tail, finder->text + p->text, p->len);
+    }
+}
+
+/* Ranks for FINDER_SLICE_MS, then shows what it has. The candidates are
+ * the rank_old paths left in matches by the last query, then the paths
+ * from rank_first_new to rank_end. If paths were removed or moved in
+ * between, it starts over. */
+static void finder_rank_slice() {
+    Uint32 start = SDL_GetTicks();
+    int total = rank_old + rank_end - rank_first_new;
+
+    trace_begin("finder_rank_slice");
+    SDL_LockMutex(finder->lock);
+    if (finder->removals != rank_removals) {
+        SDL_UnlockMutex(finder->lock);
+        ranked = false;
+        finder_rank(query);
+        trace_end();
+        return;
+    }
+
+    for (; rank_next < total; rank_next++) {
+        int k = rank_next < rank_old ? matches[rank_next] : rank_first_new + rank_next - rank_old;
+        struct FinderPath *p = &finder->paths[k];
+        struct FinderMatch m;
+
+        if ((rank_next & 4095) == 0 && SDL_GetTicks() - start >= FINDER_SLICE_MS) break;
+        if (p->len < 0 || (q_mask & ~p->mask)) continue;
+        m.score = finder_score(query, q_len, finder->text + p->text, p);
+        if (m.score == FUZZY_NO_MATCH) continue;
+        m.path = k;
+        m.len = p->len;
+        matches[match_count++] = k;
+        top_offer(m);
+    }
+    if (rank_next == total) {
+        ranking = false;
+        ranked = true;
+        ranked_count = rank_end;
+    }
+    finder_show();
+    SDL_UnlockMutex(finder->lock);
+
+    last_rank = SDL_GetTicks();
+    /* Paths that came in while ranking get their turn in finder_collect. */
+    if (!ranking && SDL_AtomicGet(&finder->notified)) jobs_notify();
+    trace_end();
+}
+
+/* Starts ranking the index against q. When q only adds to the last query,
+ * which finished, and nothing was removed from the index since, only the
+ * paths that matched then and the ones added since are looked at. */
+static void finder_rank(const char *q) {
+    int i;
+
+    SDL_LockMutex(finder->lock);
+    if (ranked && finder->removals == rank_removals && string_begins_with(q, query)) {
+        rank_old = match_count;
+        rank_first_new = ranked_count;
+    } else {
+        rank_old = rank_first_new = 0;
+    }
+    rank_end = finder->count;
+    rank_removals = finder->removals;
+    if (finder->count > match_cap) {
+        match_cap = finder->count;
+        matches = reallocate(matches, match_cap * sizeof(int));
+    }
+    SDL_UnlockMutex(finder->lock);
+
+    if (q != query) strcpy(query, q);
+    q_len = strlen(query);
+    q_mask = 0;
+    for (i = 0; i < q_len; i++) q_mask |= char_mask(query[i]);
+
+    rank_next = 0;
+    match_count = 0;
+    top_count = 0;
+    ranked = false;
+    ranking = true;
+    finder_rank_slice();
+}
+
+/* Opens the file at relative under the root, or finds the buffer that
+ * already has it. New buffers go after after in the buffer list. */
+static struct Buffer *finder_open_file(const char *relative, struct Buffer *after) {
+    char path[BUF_NAME_LEN*2], absolute_path[BUF_NAME_LEN] = {0}, name[BUF_NAME_LEN];
+    struct Buffer *buf;
+
+    if (!finder) return NULL;
+    sprintf(path, "%s%s", finder->root, relative);
+    _fullpath(absolute_path, path, BUF_NAME_LEN);
+
+    buf = buffer_find_file(absolute_path);
+    if (buf) {
+        session_load_buffer(buf);
+        return buf;
+    }
+
+    remove_directory(name, absolute_path);
+    buf = buffer_allocate(name);
+    if (buffer_load_file(buf, absolute_path)) {
+        buffer_deallocate(buf);
+        return NULL;
+    }
+    buf->next = after->next;
+    buf->prev = after;
+    if (after->next) after->next->prev = buf;
+    after->next = buf;
+    return buf;
+}
+
+/* RETURN in the *files* buffer opens the file at point in the other panel. */
+static int finder_goto_file() {
+    struct Line *line = buffer_curr_point(files_buf)->line;
+    struct Buffer *buf;
+
+    if (line->y == 0) return 0;
+    buf = finder_open_file(line->str, files_buf);
+    if (!buf) return 0;
+
+    panel_show_other(files_buf, buf);
+    curbuf = buf;
+    return 0;
+}
+
+/* Called when the Find file prompt opens over from. Starts indexing the
+ * root, or refreshing the index if it's for the same one, and shows
+ * *files* in the other panel. */
+void finder_open(struct Buffer *from) {
+    char root[BUF_NAME_LEN];
+
+    finder_root(from, root);
+
+    if (!files_buf) {
+        files_buf = buffer_allocate("*files*");
+        files_buf->read_only = true;
+        files_buf->on_return = finder_goto_file;
+
+        files_buf->next = from->next;
+        files_buf->prev = from;
+        if (from->next) from->next->prev = files_buf;
+        from->next = files_buf;
+    }
+
+    if (finder && strcmp(finder->root, root)) finder_free();
+    if (!finder) {
+        finder = alloc(1, sizeof(struct FinderIndex));
+        strcpy(finder->root, root);
+        finder->lock = SDL_CreateMutex();
+        finder_start(finder);
+    } else if (!SDL_AtomicGet(&finder->running)) {
+        finder_start(finder);
+    }
+
+    ranked = false;
+    finder_rank("");
+    if (from != files_buf) panel_show_other(from, files_buf);
+}
+
+/* Called after every key in the prompt. */
+void finder_update(const char *q) {
+    if (!finder || ((ranked || ranking) && 0 == strcmp(q, query))) return;
+    if (strlen(q) >= BUF_NAME_LEN) return;
+    finder_rank(q);
+}
+
+/* Re-ranks with what the worker has added since, when it wakes the main
+ * loop up, at most every FINDER_RANK_MS until it's done. */
+void finder_collect() {
+    bool finished;
+
+    if (!finder || ranking || !SDL_AtomicGet(&finder->notified)) return;
+    SDL_AtomicSet(&finder->notified, 0);
+    finished = !SDL_AtomicGet(&finder->running);
+    if (!finished && SDL_GetTicks() - last_rank < FINDER_RANK_MS) return;
+    finder_rank(query);
+}
+
+/* Whether a ranking is part way through, to keep the main loop drawing. */
+bool finder_ranking() {
+    return finder && ranking;
+}
+
+/* Ranks another slice. Called once a frame. */
+void finder_continue() {
+    if (finder && ranking) finder_rank_slice();
+}
+
+/* RETURN in the prompt: opens the best match. */
+struct Buffer *finder_accept(struct Buffer *from) {
+    if (!files_buf || !files_buf->start_line->next) return NULL;
+    return finder_open_file(files_buf->start_line->next->str, from);
+}
+
+/* Called when buf is about to be deallocated. */
+void finder_forget(struct Buffer *buf) {
+    if (buf != files_buf) return;
+
+    if (finder) finder_free();
+    dealloc(matches);
+    matches = NULL;
+    match_count = match_cap = 0;
+    files_buf = NULL;
+}
@@ -0,0 +1,70 @@
+#ifndef FINDER_H_
+#define FINDER_H_
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "buffer.h"
+
+/* Find file: Ctrl+P asks for part of a path and lists the files under the
+   project root that fuzzy match it best in a read-only *files* buffer,
+   re-ranked on every key. RETURN opens the best one, or the one at point
+   in *files*. The root is the nearest directory up from the buffer's with
+   a .git in it, or the buffer's own.
+
+   A worker walks the tree into a flat index of paths, which can be
+   searched while it's still growing. Opening the finder again has the
+   worker stat every directory it knows and read again only the ones whose
+   modification time changed, so the index stays fresh without a full
+   walk. Paths carry a mask of the letters in them to skip the ones that
+   can't match, and a longer query only looks at the paths the shorter
+   one matched. Ranking a big index is done a slice a frame, showing the
+   best so far, so the first results come up right away. */
+
+#define FINDER_SHOWN      100  /* Best matches listed in *files*. */
+#define FINDER_NAME_BONUS 32   /* For matching in the file name rather than the directories. */
+#define FINDER_RANK_MS    100  /* Least time between re-ranks while the index grows. */
+#define FINDER_SLICE_MS   8    /* Ranking longer than this goes on over the next frames. */
+
+struct FinderPath {
+    int text;                  /* Where it starts in the index's text, relative to the root. */
+    int len;                   /* Or -1 once its file is gone. */
+    int name;                  /* Where the file name starts in it. */
+    unsigned mask;             /* Characters in it, folded into 32 bits. */
+};
+
+/* A directory the worker has read. Only the worker touches these. */
+struct FinderDir {
+    char *path;                /* Relative to the root, ending in a slash, or "" for the root. */
+    time_t mtime;              /* When it was read. */
+    int *files, file_count, file_cap;   /* Its paths in the index. */
+    int *dirs, dir_count, dir_cap;      /* Its subdirectories. */
+    bool dead;
+};
+
+struct FinderIndex {
+    char root[BUF_NAME_LEN];   /* Ending in a slash. */
+    SDL_mutex *lock;           /* Held while the worker changes the paths and while they're ranked. */
+    char *text;
+    int text_len, text_cap;
+    struct FinderPath *paths;
+    int count, cap, dead;
+    unsigned removals;         /* Bumped when paths are taken out or moved. */
+
+    struct FinderDir *dirs;
+    int dir_count, dir_cap;
+
+    SDL_atomic_t running;      /* A walk or refresh hasn't finished. */
+    SDL_atomic_t cancel;
+    SDL_atomic_t notified;
+};
+
+void           finder_open(struct Buffer *from);
+void           finder_update(const char *query);
+void           finder_collect();
+bool           finder_ranking();
+void           finder_continue();
+struct Buffer *finder_accept(struct Buffer *from);
+void           finder_forget(struct Buffer *buf);
+
+#endif /* FINDER_H_ */
@@ -0,0 +1,52 @@
+#include "fuzzy.h"
+
+#include <stdbool.h>
+
+#define lower(c) ((c) >= 'A' && (c) <= 'Z' ? (c) - 'A' + 'a' : (c))
+
+/* Whether str[i] starts a word: after a separator, or a capital after a
+ * lower case letter. */
+static bool is_boundary(const char *str, int i) {
+    char prev;
+    if (i == 0) return true;
+    prev = str[i-1];
+    if (prev == '/' || prev == '\\' || prev == '_' || prev == '-' || prev == '.' || prev == ' ') return true;
+    return prev >= 'a' && prev <= 'z' && str[i] >= 'A' && str[i] <= 'Z';
+}
+
+/* The score of query in str, or FUZZY_NO_MATCH. The first place the whole
+ * query fits is found going forward, then narrowed going back from its
+ * end, so "ac" in "abc_ac" is scored on the shorter "ac". */
+int fuzzy_score(const char *query, int query_len, const char *str, int len) {
+    int i, q, start, end, score = 0;
+    bool prev_matched = false;
+
+    if (query_len == 0) return 0;
+
+    for (i = 0, q = 0; i < len && q < query_len; i++) {
+        if (lower(str[i]) == lower(query[q])) q++;
+    }
+    if (q < query_len) return FUZZY_NO_MATCH;
+    end = i;
+
+    for (i = end-1, q = query_len-1; q >= 0; i--) {
+        if (lower(str[i]) == lower(query[q])) q--;
+    }
+    start = i+1;
+
+    for (i = start, q = 0; i < end; i++) {
+        if (q < query_len && lower(str[i]) == lower(query[q])) {
+            score += FUZZY_MATCH;
+            if (prev_matched)         score += FUZZY_CONSECUTIVE;
+            if (is_boundary(str, i))  score += FUZZY_BOUNDARY;
+            if (str[i] == query[q])   score += FUZZY_SAME_CASE;
+            prev_matched = true;
+            q++;
+        } else {
+            score -= FUZZY_GAP;
+            prev_matched = false;
+        }
+    }
+    score -= start < FUZZY_MAX_LEADING ? start : FUZZY_MAX_LEADING;
+    return score;
+}
@@ -0,0 +1,21 @@
+#ifndef FUZZY_H_
+#define FUZZY_H_
+
+/* Fuzzy matching for completion. A query matches a string if its
+   characters appear in it in order, ignoring case. The match is scored
+   so the ones a person meant come first: characters matched one after
+   another, at the start of a word or path component, and in the same
+   case score higher, and characters skipped in between cost a little. */
+
+#define FUZZY_NO_MATCH    (-1000000)
+
+#define FUZZY_MATCH       16
+#define FUZZY_CONSECUTIVE 8
+#define FUZZY_BOUNDARY    8
+#define FUZZY_SAME_CASE   1
+#define FUZZY_GAP         1
+#define FUZZY_MAX_LEADING 8   /* Characters before the match cost up to this much. */
+
+int fuzzy_score(const char *query, int query_len, const char *str, int len);
+
+#endif /* FUZZY_H_ */
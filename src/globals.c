@@ -12,6 +12,8 @@ int mx, my;
 int pmx, pmy;
 
 double dt;
+int max_fps = 60;
+int tab_width = 4;
 
 const SDL_Color BG = {0, 0, 0, 255};
 const SDL_Color POINT = {255, 255, 255, 255};
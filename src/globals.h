@@ -16,6 +16,8 @@ extern int window_width, window_height;
 extern int font_w, font_h;
 
 extern double dt; /* Difference in milliseconds between this frame and the last. */
+extern int tab_width; /* Columns a tab takes up. At least 1. */
+extern int max_fps; /* Most frames a second while something animates, or 0 for no cap. */
 
 extern const SDL_Color BG, POINT;
 
@@ -0,0 +1,452 @@
+#include "grep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "globals.h"
+#include "util.h"
+#include "trace.h"
+#include "panel.h"
+#include "jobs.h"
+#include "session.h"
+
+static struct Buffer *grep_buf = NULL;
+static struct GrepSearch *search = NULL;
+
+static struct GrepResult *results = NULL; /* Sorted by y, since lines are only ever appended. */
+static int result_count = 0, result_cap = 0;
+static char **paths = NULL;               /* Files with matches, in the order they came in. */
+static int path_count = 0, path_cap = 0;
+
+static struct Line *tail = NULL;          /* Last line of the *grep* buffer. */
+static char query[SEARCH_MAX_LEN] = {0};
+static char root[BUF_NAME_LEN] = {0};
+static bool stopped = false;
+
+/* Windows has no mmap, and the files are only read once, so one fread
+ * is just as good there. */
+#ifdef _WIN32
+static char *grep_map_file(const char *path, int *len) {
+    FILE *fp = fopen(path, "rb");
+    long size;
+    char *data;
+
+    if (!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size <= 0 || size > INT_MAX) {
+        fclose(fp);
+        return NULL;
+    }
+
+    data = alloc(size, sizeof(char));
+    *len = fread(data, 1, size, fp);
+    fclose(fp);
+    return data;
+}
+
+static void grep_unmap_file(char *data, int len) {
+    (void)len;
+    dealloc(data);
+}
+#else
+static char *grep_map_file(const char *path, int *len) {
+    struct stat st;
+    void *data;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || st.st_size > INT_MAX) {
+        close(fd);
+        return NULL;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    *len = st.st_size;
+    return data;
+}
+
+static void grep_unmap_file(char *data, int len) {
+    munmap(data, len);
+}
+#endif
+
+/* Only wakes the main loop if there isn't a wakeup on its way already. */
+static void grep_notify(struct GrepSearch *s) {
+    if (SDL_AtomicCAS(&s->notified, 0, 1)) jobs_notify();
+}
+
+static void grep_job_done(struct GrepSearch *s) {
+    if (SDL_AtomicAdd(&s->pending, -1) == 1) grep_notify(s);
+}
+
+static void grep_add_hit(struct GrepFile *file, int line_y, const char *text, int len) {
+    struct GrepHit *hit;
+
+    if (len > 0 && text[len-1] == '\r') len--;
+    if (len > GREP_MAX_TEXT) len = GREP_MAX_TEXT;
+
+    if (file->count == file->cap) {
+        file->cap = file->cap ? file->cap*2 : 16;
+        file->hits = reallocate(file->hits, file->cap * sizeof(struct GrepHit));
+    }
+    hit = &file->hits[file->count++];
+    hit->line_y = line_y;
+    hit->len = len;
+    hit->text = alloc(len+1, sizeof(char));
+    memcpy(hit->text, text, len);
+}
+
+/* Searches the whole file at once instead of line by line, and only counts
+ * newlines up to each match. Takes ownership of path. */
+static void grep_file(struct GrepSearch *s, char *path) {
+    struct GrepFile *file = NULL;
+    int len, pos = 0, counted = 0, line_y = 0, line_start = 0, match;
+    char *data = grep_map_file(path, &len);
+
+    SDL_AtomicAdd(&s->files_searched, 1);
+
+    /* Files with a NUL in the first few KB are most likely binary. */
+    if (!data || memchr(data, 0, len < 8192 ? len : 8192)) {
+        if (data) grep_unmap_file(data, len);
+        dealloc(path);
+        return;
+    }
+
+    while (pos < len && (match = search_find(&s->pat, data, len, pos)) >= 0) {
+        char *nl, *end;
+
+        for (nl = memchr(data + counted, '\n', match - counted); nl; nl = memchr(nl+1, '\n', data + match - (nl+1))) {
+            line_y++;
+            line_start = nl+1 - data;
+        }
+        counted = match;
+
+        end = memchr(data + match, '\n', len - match);
+        if (!end) end = data + len;
+
+        if (!file) file = alloc(1, sizeof(struct GrepFile));
+        grep_add_hit(file, line_y, data + line_start, end - (data + line_start));
+
+        /* One hit per line. The newline after it still gets counted. */
+        counted = pos = end - data;
+    }
+    grep_unmap_file(data, len);
+
+    if (!file) {
+        dealloc(path);
+        return;
+    }
+    file->path = path;
+
+    SDL_LockMutex(s->lock);
+    if (s->done_tail) s->done_tail->next = file;
+    else              s->done_head = file;
+    s->done_tail = file;
+    SDL_UnlockMutex(s->lock);
+
+    grep_notify(s);
+}
+
+static void grep_batch_run(void *data) {
+    struct GrepBatch *batch = data;
+    struct GrepSearch *s = batch->search;
+    int i;
+
+    trace_begin("grep_batch");
+    for (i = 0; i < batch->count; i++) {
+        if (SDL_AtomicGet(&s->cancel)) dealloc(batch->paths[i]);
+        else                           grep_file(s, batch->paths[i]);
+    }
+    dealloc(batch);
+    grep_job_done(s);
+    trace_end();
+}
+
+static void grep_submit_batch(struct GrepSearch *s, struct GrepBatch *batch) {
+    SDL_AtomicAdd(&s->pending, 1);
+    jobs_submit(s, grep_batch_run, batch);
+}
+
+/* Skips anything hidden, like .git, along with . and .. */
+static void grep_walk(struct GrepSearch *s, const char *dir, struct GrepBatch **batch) {
+    DIR *d = opendir(dir);
+    struct dirent *ent;
+
+    if (!d) return;
+    while ((ent = readdir(d)) != NULL && !SDL_AtomicGet(&s->cancel)) {
+        char path[BUF_NAME_LEN];
+        struct stat st;
+
+        if (ent->d_name[0] == '.') continue;
+        if (strlen(dir) + strlen(ent->d_name) + 2 > BUF_NAME_LEN) continue;
+
+        strcpy(path, dir);
+        strcat(path, ent->d_name);
+        if (stat(path, &st) != 0) continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            strcat(path, "/");
+            grep_walk(s, path, batch);
+        } else if (S_ISREG(st.st_mode)) {
+            if (!*batch) {
+                *batch = alloc(1, sizeof(struct GrepBatch));
+                (*batch)->search = s;
+            }
+            (*batch)->paths[(*batch)->count] = alloc(strlen(path)+1, sizeof(char));
+            strcpy((*batch)->paths[(*batch)->count++], path);
+
+            if ((*batch)->count == GREP_BATCH_FILES) {
+                grep_submit_batch(s, *batch);
+                *batch = NULL;
+            }
+        }
+    }
+    closedir(d);
+}
+
+/* The walker has a worker to itself, so huge trees don't hold up the UI. */
+static void grep_walk_run(void *data) {
+    struct GrepSearch *s = data;
+    struct GrepBatch *batch = NULL;
+
+    grep_walk(s, s->root, &batch);
+    if (batch) grep_submit_batch(s, batch);
+    grep_job_done(s);
+}
+
+static void grep_free_files(struct GrepFile *file) {
+    while (file) {
+        struct GrepFile *next = file->next;
+        int i;
+        for (i = 0; i < file->count; i++) dealloc(file->hits[i].text);
+        dealloc(file->hits);
+        dealloc(file->path);
+        dealloc(file);
+        file = next;
+    }
+}
+
+static void grep_search_free() {
+    grep_free_files(search->done_head);
+    SDL_DestroyMutex(search->lock);
+    dealloc(search);
+    search = NULL;
+}
+
+/* Queued batches aren't taken back since they own their paths, but they
+ * free them without reading anything once cancel is set. */
+static void grep_cancel() {
+    SDL_AtomicSet(&search->cancel, 1);
+    while (SDL_AtomicGet(&search->pending) > 0) SDL_Delay(1);
+    grep_search_free();
+    stopped = true;
+}
+
+static void grep_update_header() {
+    char header[SEARCH_MAX_LEN + BUF_NAME_LEN + 128];
+    char progress[64];
+
+    if (search) sprintf(progress, "searching... %d files", SDL_AtomicGet(&search->files_searched));
+    else        strcpy(progress, stopped ? "stopped early" : "done");
+
+    sprintf(header, "%d matches for \"%s\" in %d files under %s (%s)", result_count, query, path_count, root, progress);
+    line_set_string(grep_buf->start_line, header, strlen(header));
+}
+
+static void grep_clear_results() {
+    int i;
+    for (i = 0; i < path_count; i++) dealloc(paths[i]);
+    path_count = 0;
+    result_count = 0;
+}
+
+/* Starts searching every file under directory (relative to buf's) for query.
+ * Returns the *grep* buffer, which fills in as the workers finish, or NULL
+ * if the directory doesn't exist. */
+struct Buffer *grep_start(struct Buffer *buf, char *q, char *directory) {
+    char path[BUF_NAME_LEN*2] = {0};
+    char absolute_path[BUF_NAME_LEN] = {0};
+    int len;
+
+    if (!strlen(q) || buf->is_singular) return NULL;
+
+    resolve_path(path, buf->directory, directory);
+    _fullpath(absolute_path, path, BUF_NAME_LEN);
+    len = strlen(absolute_path);
+    if (!len || len >= BUF_NAME_LEN-1 || !is_directory(absolute_path)) return NULL;
+    if (absolute_path[len-1] != '/' && absolute_path[len-1] != '\\') strcat(absolute_path, "/");
+
+    if (search) grep_cancel();
+
+    search = alloc(1, sizeof(struct GrepSearch));
+    if (!search_compile(&search->pat, q)) {
+        dealloc(search);
+        search = NULL;
+        return NULL;
+    }
+    strcpy(search->root, absolute_path);
+    search->lock = SDL_CreateMutex();
+
+    if (!grep_buf) {
+        grep_buf = buffer_allocate("*grep*");
+        grep_buf->read_only = true;
+        grep_buf->on_return = grep_goto_source;
+
+        grep_buf->next = buf->next;
+        grep_buf->prev = buf;
+        if (buf->next) buf->next->prev = grep_buf;
+        buf->next = grep_buf;
+    } else {
+        buffer_clear(grep_buf);
+    }
+    grep_clear_results();
+    tail = grep_buf->start_line;
+    strcpy(query, q);
+    strcpy(root, absolute_path);
+    stopped = false;
+
+    SDL_AtomicSet(&search->pending, 1);
+    jobs_submit(search, grep_walk_run, search);
+
+    grep_update_header();
+    return grep_buf;
+}
+
+static void grep_add_file(struct GrepFile *file) {
+    int i;
+
+    if (path_count == path_cap) {
+        path_cap = path_cap ? path_cap*2 : 64;
+        paths = reallocate(paths, path_cap * sizeof(char *));
+    }
+    paths[path_count] = file->path;
+    file->path = NULL;
+
+    for (i = 0; i < file->count; i++) {
+        struct GrepHit *hit = &file->hits[i];
+        const char *relative = paths[path_count] + strlen(root);
+        char *text = alloc(strlen(relative) + hit->len + 32, sizeof(char));
+        int prefix = sprintf(text, "%s:%d: ", relative, hit->line_y+1);
+
+        memcpy(text + prefix, hit->text, hit->len);
+        tail = line_insert_after(tail, text, prefix + hit->len);
+        dealloc(text);
+
+        if (result_count == result_cap) {
+            result_cap = result_cap ? result_cap*2 : 64;
+            results = reallocate(results, result_cap * sizeof(struct GrepResult));
+        }
+        results[result_count].y = tail->y;
+        results[result_count].file = path_count;
+        results[result_count].line_y = hit->line_y;
+        result_count++;
+    }
+    path_count++;
+}
+
+/* Writes the files the workers have finished into the *grep* buffer.
+ * Called whenever a worker wakes up the main loop. */
+void grep_collect() {
+    struct GrepFile *files, *file;
+    bool finished;
+
+    if (!search) return;
+
+    /* Cleared first, so anything finishing from here on wakes us again. */
+    SDL_AtomicSet(&search->notified, 0);
+    finished = SDL_AtomicGet(&search->pending) == 0;
+
+    SDL_LockMutex(search->lock);
+    files = search->done_head;
+    search->done_head = search->done_tail = NULL;
+    SDL_UnlockMutex(search->lock);
+
+    for (file = files; file; file = file->next) {
+        grep_add_file(file);
+    }
+    grep_free_files(files);
+
+    if (finished) grep_search_free();
+    grep_update_header();
+}
+
+/* Called when buf is about to be deallocated. */
+void grep_forget(struct Buffer *buf) {
+    if (buf != grep_buf) return;
+
+    if (search) grep_cancel();
+    grep_clear_results();
+    dealloc(paths);
+    dealloc(results);
+    paths = NULL;
+    results = NULL;
+    path_cap = result_cap = 0;
+    grep_buf = NULL;
+    tail = NULL;
+}
+
+/* RETURN in the *grep* buffer. Opens the file of the result at point in
+ * the other panel, at the matching line. */
+int grep_goto_source() {
+    int y = buffer_curr_point(grep_buf)->line->y;
+    int lo = 0, hi = result_count-1;
+    struct GrepResult *r = NULL;
+    struct Buffer *buf;
+    struct Point *point;
+    struct ScrollBar *scroll;
+    char absolute_path[BUF_NAME_LEN] = {0};
+
+    while (lo <= hi) {
+        int mid = lo + (hi-lo)/2;
+        if (results[mid].y < y)      lo = mid+1;
+        else if (results[mid].y > y) hi = mid-1;
+        else { r = &results[mid]; break; }
+    }
+    if (!r) return 0;
+
+    _fullpath(absolute_path, paths[r->file], BUF_NAME_LEN);
+    buf = buffer_find_file(absolute_path);
+    session_load_buffer(buf);
+    if (!buf) {
+        char buffer_name[BUF_NAME_LEN];
+        remove_directory(buffer_name, absolute_path);
+        buf = buffer_allocate(buffer_name);
+        if (buffer_load_file(buf, absolute_path)) {
+            buffer_deallocate(buf);
+            return 0;
+        }
+
+        buf->next = grep_buf->next;
+        buf->prev = grep_buf;
+        if (grep_buf->next) grep_buf->next->prev = buf;
+        grep_buf->next = buf;
+    }
+
+    panel_show_other(grep_buf, buf);
+    curbuf = buf;
+
+    point = buffer_curr_point(buf);
+    scroll = buffer_curr_scroll(buf);
+    buffer_goto_line(buf, r->line_y < buf->line_count ? r->line_y : buf->line_count-1);
+
+    int pos = line_row(point->line, point->pos)*SPACING + line_row(point->line, point->pos)*font_h;
+    if (pos < -font_h-scroll->y || pos > window_height-scroll->y-font_h*2) {
+        scroll->target_y = -font_h+(window_height/2 - font_h*2)-(SPACING*line_row(point->line, point->pos) + line_row(point->line, point->pos) * font_h);
+    }
+    return 0;
+}
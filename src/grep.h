@@ -0,0 +1,59 @@
+#ifndef GREP_H_
+#define GREP_H_
+
+#include "buffer.h"
+#include "search.h"
+
+/* Find in files. A worker walks the directory tree and hands the files out
+   in batches to the other workers, which map each one, skip it if it looks
+   binary, and search it as a whole. Matches stream into a read-only *grep*
+   buffer; RETURN on one opens the file at that line. */
+
+#define GREP_BATCH_FILES 64
+#define GREP_MAX_TEXT 256   /* Matching lines are cut off after this much. */
+
+struct GrepHit {
+    int line_y;
+    char *text;
+    int len;
+};
+
+/* The matches in one file, handed from a worker to the main thread. */
+struct GrepFile {
+    char *path;
+    struct GrepHit *hits;
+    int count, cap;
+    struct GrepFile *next;
+};
+
+struct GrepSearch {
+    struct SearchPattern pat;
+    char root[BUF_NAME_LEN];        /* Absolute, ending in a slash. */
+    SDL_atomic_t pending;           /* The walker and batches that haven't finished. */
+    SDL_atomic_t cancel;
+    SDL_atomic_t files_searched;
+    SDL_atomic_t notified;          /* Set while a wakeup is on its way, so workers don't flood the event queue. */
+
+    SDL_mutex *lock;
+    struct GrepFile *done_head, *done_tail;
+};
+
+struct GrepBatch {
+    struct GrepSearch *search;
+    char *paths[GREP_BATCH_FILES];
+    int count;
+};
+
+/* Where a line of the *grep* buffer points to. */
+struct GrepResult {
+    int y;
+    int file;                       /* Index into the paths we've collected. */
+    int line_y;
+};
+
+struct Buffer *grep_start(struct Buffer *buf, char *query, char *directory);
+void           grep_collect();
+void           grep_forget(struct Buffer *buf);
+int            grep_goto_source();
+
+#endif /* GREP_H_ */
@@ -1,50 +1,110 @@
 #include "highlight.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "globals.h"
 #include "buffer.h"
+#include "util.h"
+
+Uint32 highlight_fade_end = 0;
 
-int animated_highlights_active = 0;
+bool highlights_animating(Uint32 now) {
+    return !SDL_TICKS_PASSED(now, highlight_fade_end);
+}
 
-void highlight_draw(struct Highlight hl, int xoff, int yoff) {
-    struct SDL_Rect r = { xoff + hl.pos * font_w,  yoff, hl.len * font_w, font_h };
-    Uint8 alpha = 255;
-    if (hl.is_temp) {
-        alpha = (Uint8)(255.0 * (hl.time / hl.total_time));
+/* Index of the first highlight at or after (y, pos). Lines never change
+ * order, so sorting by line number stays valid across edits. */
+static int highlight_lower_bound(struct HighlightStore *store, int y, int pos) {
+    int lo = 0, hi = store->count;
+    while (lo < hi) {
+        int mid = lo + (hi-lo)/2;
+        struct Highlight *hl = &store->hls[mid];
+        if (hl->line->y < y || (hl->line->y == y && hl->pos < pos)) lo = mid+1;
+        else hi = mid;
     }
-    SDL_SetRenderDrawColor(renderer, hl.col.r, hl.col.g, hl.col.b, alpha);
-    SDL_RenderFillRect(renderer, &r);
+    return lo;
 }
 
-void highlight_set(struct Highlight *hl, struct Line *line, SDL_Color col, int pos, int len, bool temp) {
-    hl->total_time = 1.0;
-    hl->time = hl->total_time;
-    hl->is_temp = temp;
+/* Full stores drop new highlights once the faded flashes are gone, which
+ * can only happen with flashes nobody will see anyway. */
+void highlight_add(struct Line *line, int pos, int len, SDL_Color col, bool temp, int view) {
+    struct HighlightStore *store = &line->buf->highlights;
+    struct Highlight *hl;
+    int i;
+
+    if (store->count == HIGHLIGHT_MAX) highlight_update(store, SDL_GetTicks());
+    if (store->count == HIGHLIGHT_MAX) return;
+    if (store->count == store->cap) {
+        store->cap = store->cap ? store->cap*2 : 64;
+        store->hls = reallocate(store->hls, store->cap * sizeof(struct Highlight));
+    }
+
+    i = highlight_lower_bound(store, line->y, pos);
+    memmove(&store->hls[i+1], &store->hls[i], (store->count-i) * sizeof(struct Highlight));
+    store->count++;
+
+    hl = &store->hls[i];
+    hl->line = line;
     hl->pos = pos;
     hl->len = len;
     hl->col = col;
-    hl->active = 1;
-    hl->line = line;
-    line->hl_count++;
-    animated_highlights_active++;
+    hl->view = view;
+    hl->is_temp = temp;
+    hl->start = SDL_GetTicks();
+    if (temp) highlight_fade_end = hl->start + HIGHLIGHT_FADE_MS;
 }
 
-void highlight_stop(struct Highlight *hl) {
-    hl->line->hl_count--;
-    animated_highlights_active--;
-    memset(hl, 0, sizeof(*hl));
+/* Removes the marks shown in view, leaving the flashes alone. */
+void highlight_remove_view(struct HighlightStore *store, int view) {
+    int i, kept = 0;
+    for (i = 0; i < store->count; i++) {
+        if (!store->hls[i].is_temp && store->hls[i].view == view) continue;
+        store->hls[kept++] = store->hls[i];
+    }
+    store->count = kept;
 }
 
-void highlight_update(struct Highlight *hl) {
-    if (!hl->active || !hl->is_temp) return;
+/* Called before a line is deallocated. */
+void highlight_forget_line(struct HighlightStore *store, struct Line *line) {
+    int i, kept = 0;
+    for (i = 0; i < store->count; i++) {
+        if (store->hls[i].line == line) continue;
+        store->hls[kept++] = store->hls[i];
+    }
+    store->count = kept;
+}
 
-    if (hl->time <= 0) {
-        hl->time = 0;
-        hl->active = 0;
-        animated_highlights_active--;
-        hl->line->hl_count--;
-    } else {
-        hl->time -= dt/1000.0;
-        if (hl->time < 0) hl->time = 0;
+void highlight_clear(struct HighlightStore *store) {
+    dealloc(store->hls);
+    store->hls = NULL;
+    store->count = store->cap = 0;
+}
+
+/* Fades the flashes, and removes the ones that are done. */
+void highlight_update(struct HighlightStore *store, Uint32 now) {
+    int i, kept = 0;
+    for (i = 0; i < store->count; i++) {
+        struct Highlight *hl = &store->hls[i];
+        if (hl->is_temp && now - hl->start >= HIGHLIGHT_FADE_MS) continue;
+        store->hls[kept++] = *hl;
     }
+    store->count = kept;
 }
 
+void highlight_draw_line(struct HighlightStore *store, struct Line *line, int view, int xoff, int yoff, Uint32 now) {
+    int i;
+    for (i = highlight_lower_bound(store, line->y, 0); i < store->count && store->hls[i].line == line; i++) {
+        struct Highlight *hl = &store->hls[i];
+        Uint8 alpha = 255;
+
+        if (hl->view != -1 && hl->view != view) continue;
+        if (hl->is_temp) {
+            Uint32 age = now - hl->start;
+            if (age >= HIGHLIGHT_FADE_MS) continue;
+            alpha = (Uint8)(255 - 255 * age / HIGHLIGHT_FADE_MS);
+        }
+        SDL_SetRenderDrawColor(renderer, hl->col.r, hl->col.g, hl->col.b, alpha);
+        wrap_fill_cols(line, line_visual_col(line, hl->pos), line_visual_col(line, hl->pos + hl->len), xoff, yoff, font_h);
+    }
+}
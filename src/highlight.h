@@ -4,20 +4,39 @@
 #include <stdbool.h>
 #include <SDL2/SDL.h>
 
+/* Most highlights we keep per buffer. Only what's on screen and the
+   flashes that are fading away are stored, so this is plenty. */
+#define HIGHLIGHT_MAX 4096
+
+#define HIGHLIGHT_FADE_MS 1000 /* How long a flash takes to fade away. */
+
 struct Highlight {
-    int active;
-    float time, total_time;
-    bool is_temp; /* Does this one fade away? */
+    struct Line *line;
     int pos, len;
     SDL_Color col;
-    struct Line *line;
+    int view;            /* The view it shows in, or -1 for every view. */
+    bool is_temp;        /* Does this one fade away? */
+    Uint32 start;        /* When it started fading, in ticks. */
 };
 
-extern int animated_highlights_active;
+/* A buffer's highlights, sorted by line and then position. */
+struct HighlightStore {
+    struct Highlight *hls;
+    int count, cap;
+};
+
+/* When the last flash in any buffer will have faded, in ticks. Flashes
+   fade by the clock, so ones in buffers that aren't drawn can't keep the
+   animation going. */
+extern Uint32 highlight_fade_end;
+
+bool highlights_animating(Uint32 now);
 
-void highlight_set(struct Highlight *hl, struct Line *line, SDL_Color col, int pos, int len, bool temp);
-void highlight_stop(struct Highlight *hl);
-void highlight_update(struct Highlight *hl);
-void highlight_draw(struct Highlight hl, int xoff, int yoff);
+void highlight_add(struct Line *line, int pos, int len, SDL_Color col, bool temp, int view);
+void highlight_remove_view(struct HighlightStore *store, int view);
+void highlight_forget_line(struct HighlightStore *store, struct Line *line);
+void highlight_clear(struct HighlightStore *store);
+void highlight_update(struct HighlightStore *store, Uint32 now);
+void highlight_draw_line(struct HighlightStore *store, struct Line *line, int view, int xoff, int yoff, Uint32 now);
 
-#endif /* HIGHLIGHT_H_ */
\ No newline at end of file
+#endif /* HIGHLIGHT_H_ */
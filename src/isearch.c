@@ -3,23 +3,37 @@
 #include "globals.h"
 #include "mark.h"
 #include "util.h"
+#include "trace.h"
+#include "search.h"
+#include "jobs.h"
+
+#include <stdlib.h>
+
+static const SDL_Color first_match_color = {202, 127, 235, 255};
+static const SDL_Color match_color = {0, 127, 255, 255};
+static const SDL_Color goto_color = {0, 64, 127, 255};
+
+/* Centers the view on line if it's off screen. */
+static void isearch_scroll_to(struct Buffer *buf, struct Line *line) {
+    struct ScrollBar *scroll = &buf->views[buf->curview].scroll;
+    int pos = line_row(line, 0)*SPACING + line_row(line, 0)*font_h;
+    if (pos < -font_h-scroll->y || pos > window_height-scroll->y-font_h*2) {
+        scroll->target_y = -font_h+(window_height/2 - font_h*2)-(SPACING*line_row(line, 0) + line_row(line, 0) * font_h);
+    }
+}
 
 void buffer_isearch_goto_matching(struct Buffer *buf, char *str) {
     struct Line *line;
     struct Isearch *search = buf->views[buf->curview].search;
     struct Point *point = &buf->views[buf->curview].point;
-    struct ScrollBar *scroll = &buf->views[buf->curview].scroll;
+    struct SearchPattern pat;
 
     if (!strlen(str)) return;
+    if (!search_compile(&pat, str)) return;
 
+    trace_begin("isearch_goto_matching");
     strcpy(search->str, str);
-
-    /* Destroy previous highlights so we can update it properly. */
-    for (line = point->line; line; line = line->next) {
-        int i, c = line->hl_count;
-        for (i = 0; i < c; i++)
-            highlight_stop(&line->hls[i]);
-    }
+    isearch_unmark(buf);
 
     for (line = point->line; line; line = line->next) {
         int start = 0;
@@ -28,86 +42,330 @@ void buffer_isearch_goto_matching(struct Buffer *buf, char *str) {
             if (start >= line->len) continue;
         }
 
-        while (start < line->len) {
-            char *match = stristr(line->str + start, str);
-            if (match) {
-                point->line = line;
-                point->pos = match - line->str;
-                start = point->pos+1;
-    
-                highlight_set(&line->hls[line->hl_count], line, (SDL_Color){0, 64, 127, 255}, point->pos, strlen(str), true);
-    
-                int pos = point->line->y*SPACING + point->line->y*font_h;
-                if (pos < -font_h-scroll->y || pos > window_height-scroll->y-font_h*2) {
-                    scroll->target_y = -font_h+(window_height/2 - font_h*2)-(SPACING*point->line->y + point->line->y * font_h);
-                }
-                goto end_of_buffer_isearch_goto_matching;
-            } else {
-                start++;
-            }
+        int match = search_find(&pat, line->str, line->len, start);
+        if (match >= 0) {
+            point->line = line;
+            point->pos = match;
+
+            highlight_add(line, point->pos, pat.len, goto_color, true, -1);
+            isearch_scroll_to(buf, line);
+            goto end_of_buffer_isearch_goto_matching;
         }
     }
   end_of_buffer_isearch_goto_matching:
     if (point->pos > point->line->len) {
         point->pos = point->line->len;
     }
+    trace_end();
+}
+
+void isearch_invalidate(struct Isearch *search) {
+    search->cache_valid = false;
+}
+
+static void hits_push(struct Line ***hits, int *count, int *cap, struct Line *line) {
+    if (*count == *cap) {
+        *cap = *cap ? *cap*2 : 64;
+        *hits = reallocate(*hits, *cap * sizeof(struct Line *));
+    }
+    (*hits)[(*count)++] = line;
+}
+
+/* Counts the matches in line from start on, setting first to the first
+ * of them if it isn't set yet. */
+static int isearch_count_line(const struct SearchPattern *pat, struct Line *line, int start, struct IsearchMatch *first) {
+    int match, count = 0;
+
+    if (start >= line->len) return 0;
+    for (match = search_find(pat, line->str, line->len, start); match >= 0; match = search_find(pat, line->str, line->len, match+1)) {
+        if (!first->line) {
+            first->line = line;
+            first->pos = match;
+        }
+        count++;
+    }
+    return count;
+}
+
+/* Runs on a worker thread. Nothing edits the buffer while a scan is
+ * running, since edits call isearch_stop_scans first. */
+static void isearch_chunk_run(void *data) {
+    struct IsearchChunk *chunk = data;
+    struct IsearchScan *scan = chunk->scan;
+    struct Line *line = chunk->first;
+    int i;
+
+    trace_begin("isearch_chunk");
+    for (i = 0; i < chunk->line_count && line; i++, line = line->next) {
+        int n;
+        if (SDL_AtomicGet(&scan->cancel)) break;
+
+        n = isearch_count_line(&scan->pat, line, i == 0 ? chunk->start : 0, &chunk->first_match);
+        if (n) {
+            chunk->count += n;
+            hits_push(&chunk->hits, &chunk->hit_count, &chunk->hit_cap, line);
+        }
+    }
+
+    /* The scan can be freed as soon as pending drops, so that's the last
+     * thing done to it. */
+    SDL_AtomicSet(&chunk->done, 1);
+    SDL_AtomicAdd(&scan->pending, -1);
+    jobs_notify();
+    trace_end();
 }
 
+static void isearch_scan_free(struct Buffer *buf, struct Isearch *search) {
+    struct IsearchScan *scan = search->scan;
+    int i;
+    for (i = 0; i < scan->chunk_count; i++) dealloc(scan->chunks[i].hits);
+    dealloc(scan->chunks);
+    dealloc(scan);
+    search->scan = NULL;
+    buf->scans--;
+}
+
+/* Splits the lines from point onward into chunks for the workers. They're
+ * queued in order, so the ones nearest to point tend to finish first. */
+static void isearch_scan_start(struct Buffer *buf, struct Isearch *search) {
+    struct Point *point = &buf->views[buf->curview].point;
+    struct IsearchScan *scan = alloc(1, sizeof(struct IsearchScan));
+    struct Line *line = point->line;
+    int lines = buf->line_count - point->line->y;
+    int i;
+
+    scan->pat = search->pat;
+    scan->chunk_count = (lines + ISEARCH_CHUNK_LINES-1) / ISEARCH_CHUNK_LINES;
+    scan->chunks = alloc(scan->chunk_count, sizeof(struct IsearchChunk));
+    SDL_AtomicSet(&scan->pending, scan->chunk_count);
+
+    for (i = 0; i < scan->chunk_count; i++) {
+        struct IsearchChunk *chunk = &scan->chunks[i];
+        int j;
+        chunk->scan = scan;
+        chunk->first = line;
+        chunk->line_count = ISEARCH_CHUNK_LINES;
+        chunk->start = i == 0 ? point->pos+1 : 0;
+        for (j = 0; j < ISEARCH_CHUNK_LINES && line; j++) line = line->next;
+    }
+
+    search->scan = scan;
+    buf->scans++;
+
+    for (i = 0; i < scan->chunk_count; i++) {
+        jobs_submit(scan, isearch_chunk_run, &scan->chunks[i]);
+    }
+}
+
+/* Adds the chunks that have finished to the count, in line order, so the
+ * first match after point is known as soon as the chunks before it are. */
+static void isearch_scan_collect(struct Buffer *buf, struct Isearch *search) {
+    struct IsearchScan *scan = search->scan;
+    int i;
+
+    if (!scan) return;
+
+    while (scan->merged < scan->chunk_count && SDL_AtomicGet(&scan->chunks[scan->merged].done)) {
+        struct IsearchChunk *chunk = &scan->chunks[scan->merged];
+        if (!search->first.line && chunk->count) {
+            search->first = chunk->first_match;
+            search->shown_valid = false;
+            isearch_scroll_to(buf, search->first.line);
+        }
+        search->match_count += chunk->count;
+        for (i = 0; i < chunk->hit_count; i++) {
+            hits_push(&search->hits, &search->hit_count, &search->hit_cap, chunk->hits[i]);
+        }
+        scan->merged++;
+    }
+
+    /* A worker may still be between setting done and dropping pending. Its
+     * notify comes after, and collects again. */
+    if (scan->merged == scan->chunk_count && SDL_AtomicGet(&scan->pending) == 0) {
+        isearch_scan_free(buf, search);
+    }
+}
+
+static void isearch_scan_cancel(struct Buffer *buf, struct Isearch *search) {
+    struct IsearchScan *scan = search->scan;
+
+    SDL_AtomicSet(&scan->cancel, 1);
+    SDL_AtomicAdd(&scan->pending, -jobs_remove_group(scan));
+    /* The running ones stop after the line they're on. */
+    while (SDL_AtomicGet(&scan->pending) > 0) SDL_Delay(1);
+
+    isearch_scan_free(buf, search);
+}
+
+/* Called before anything edits the buffer, since the scans read its lines. */
+void isearch_stop_scans(struct Buffer *buf) {
+    int i;
+    for (i = 0; i < buf->view_count; i++) {
+        struct Isearch *search = buf->views[i].search;
+        if (search->scan) {
+            isearch_scan_cancel(buf, search);
+            isearch_invalidate(search);
+        }
+    }
+}
+
+/* Stops marking in the current view and removes its highlights. */
+void isearch_unmark(struct Buffer *buf) {
+    struct Isearch *search = buf->views[buf->curview].search;
+
+    if (search->scan) isearch_scan_cancel(buf, search);
+    search->marking = false;
+    search->cache_valid = false;
+    search->shown_valid = false;
+    highlight_remove_view(&buf->highlights, buf->curview);
+}
+
+/* Counts the matches after point and finds the first one. Highlighting
+ * them is left to isearch_mark_visible. When the query only adds to the
+ * last one, whose count finished, only the lines that matched it are
+ * looked at, unless there are so many they'd better go to the workers. */
 void buffer_isearch_mark_matching(struct Buffer *buf, char *str) {
     struct Line *line;
 
     struct Isearch *search = buf->views[buf->curview].search;
     struct Point *point = &buf->views[buf->curview].point;
-    struct ScrollBar *scroll = &buf->views[buf->curview].scroll;
-    
-    struct Point temp = *point;
-    bool first = true;
 
-    if (!strlen(str)) return;
+    struct SearchPattern pat;
+    bool same_place;
+    int i, kept, n;
+
+    if (!strlen(str) || strlen(str) >= sizeof(search->str)) return;
+    if (!search_compile(&pat, str)) return;
 
     strcpy(search->str, str);
 
-    /* Destroy previous marks so we can update it properly. */
+    isearch_scan_collect(buf, search);
+
+    same_place = search->cache_valid &&
+                 search->cached_version == buf->version &&
+                 search->cached_point.line == point->line &&
+                 search->cached_point.pos == point->pos;
+    if (same_place && 0 == strcmp(search->pat.str, pat.str)) return;
+
+    trace_begin("isearch_mark_matching");
+
+    if (same_place && search->marking && !search->scan &&
+        string_begins_with(pat.str, search->pat.str) &&
+        search->hit_count <= ISEARCH_CHUNK_LINES*2) {
+        search->pat = pat;
+        search->match_count = 0;
+        search->first.line = NULL;
+        search->shown_valid = false;
+
+        for (i = 0, kept = 0; i < search->hit_count; i++) {
+            line = search->hits[i];
+            n = isearch_count_line(&pat, line, line == point->line ? point->pos+1 : 0, &search->first);
+            if (n) search->hits[kept++] = line;
+            search->match_count += n;
+        }
+        search->hit_count = kept;
+
+        if (search->first.line) isearch_scroll_to(buf, search->first.line);
+        trace_end();
+        return;
+    }
+
+    if (search->scan) isearch_scan_cancel(buf, search);
+
+    search->pat = pat;
+    search->marking = true;
+    search->match_count = 0;
+    search->first.line = NULL;
+    search->hit_count = 0;
+    search->shown_valid = false;
+    search->cache_valid = true;
+    search->cached_version = buf->version;
+    search->cached_point = *point;
+
+    if (buf->line_count - point->line->y > ISEARCH_CHUNK_LINES*2) {
+        isearch_scan_start(buf, search);
+        trace_end();
+        return;
+    }
+
     for (line = point->line; line; line = line->next) {
-        int i, c = line->hl_count;
-        for (i = 0; i < c; i++)
-            highlight_stop(&line->hls[i]);
+        n = isearch_count_line(&pat, line, line == point->line ? point->pos+1 : 0, &search->first);
+        if (n) hits_push(&search->hits, &search->hit_count, &search->hit_cap, line);
+        search->match_count += n;
     }
 
+    if (search->first.line) isearch_scroll_to(buf, search->first.line);
+    trace_end();
+}
+
+/* Highlights the matches after point in the rows lines starting at line,
+ * which are the ones on screen. Called while drawing, and only redoes the
+ * work if the view, the buffer or the marking changed. */
+void isearch_mark_visible(struct Buffer *buf, struct Line *line, int rows) {
+    struct Isearch *search = buf->views[buf->curview].search;
+    struct Point *point = &buf->views[buf->curview].point;
+    struct ScrollBar *scroll = &buf->views[buf->curview].scroll;
+    int col = -scroll->x / font_w;
+    int cols = window_width / font_w + 1;
+    int i;
+
+    if (!search->marking) return;
+    if (col < 0) col = 0;
+    if (search->shown_valid &&
+        search->shown_line == line &&
+        search->shown_rows == rows &&
+        search->shown_col == col &&
+        search->shown_version == buf->version) {
+        return;
+    }
+
+    highlight_remove_view(&buf->highlights, buf->curview);
+
+    search->shown_valid = true;
+    search->shown_line = line;
+    search->shown_rows = rows;
+    search->shown_col = col;
+    search->shown_version = buf->version;
+
+    for (i = 0; i < rows && line; i++, line = line->next) {
+        int start = 0, match;
+        int first_byte = line_byte_at_col(line, col), end_byte = line_byte_at_col(line, col + cols);
+
+        if (line->y < point->line->y) continue;
+        if (line == point->line) start = point->pos+1;
+        if (start < first_byte - search->pat.len + 1) start = first_byte - search->pat.len + 1;
+
+        for (match = search_find(&search->pat, line->str, line->len, start); match >= 0 && match <= end_byte; match = search_find(&search->pat, line->str, line->len, match+1)) {
+            bool is_first = line == search->first.line && match == search->first.pos;
+            highlight_add(line, match, search->pat.len, is_first ? first_match_color : match_color, false, buf->curview);
+        }
+    }
+}
+
+/* Moves point to the next match of the regex after it. */
+bool buffer_regex_goto_matching(struct Buffer *buf, struct Regex *re) {
+    struct Line *line;
+    struct Point *point = &buf->views[buf->curview].point;
+    struct RegexMatch match;
+
+    trace_begin("regex_goto_matching");
     for (line = point->line; line; line = line->next) {
         int start = 0;
-        SDL_Color col;
-
         if (line == point->line) {
             start = point->pos+1;
-            if (start >= line->len) continue;
+            if (start > line->len) continue;
         }
-        while (start < line->len) {
-            char *match = stristr(line->str + start, str);
-            if (match) {
-                if (first) {
-                    col = (SDL_Color){202, 127, 235, 255};
-                    first = false;
-    
-                    /* If the first one is offscreen, center the screen onto it. */
-                    int pos = line->y*SPACING + line->y*font_h;
-                    if (pos < -font_h-scroll->y || pos > window_height-scroll->y-font_h*2) {
-                        scroll->target_y = -font_h+(window_height/2 - font_h*2)-(SPACING*line->y + line->y * font_h);
-                    }
-                } else {
-                    col = (SDL_Color){0, 127, 255, 255};
-                }
-    
-                point->line = line;
-                point->pos = match - line->str;
-                start = point->pos+1;
-    
-                highlight_set(&line->hls[line->hl_count], line, col, point->pos, strlen(str), false);
-            } else {
-                start++;
-            }
+
+        if (regex_find(re, line->str, line->len, start, &match)) {
+            point->line = line;
+            point->pos = match.start[0];
+
+            highlight_add(line, point->pos, match.end[0] - match.start[0], goto_color, true, -1);
+            isearch_scroll_to(buf, line);
+            trace_end();
+            return true;
         }
     }
-
-    *point = temp;
+    trace_end();
+    return false;
 }
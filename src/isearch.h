@@ -2,14 +2,75 @@
 #define ISEARCH_H_
 
 #include "buffer.h"
+#include "regex.h"
+#include "search.h"
 
 /* Incremental search near identical to emacs' search. */
 
+struct IsearchMatch {
+    struct Line *line;
+    int pos;
+};
+
+/* Buffers with more lines than this after point are counted in chunks of
+   this many lines on the worker threads. */
+#define ISEARCH_CHUNK_LINES 16384
+
+struct IsearchChunk {
+    struct IsearchScan *scan;
+    struct Line *first;
+    int line_count;
+    int start;                        /* Where to start on the first line. */
+    int count;                        /* Only touched by the worker until done is set. */
+    struct IsearchMatch first_match;
+    struct Line **hits;               /* Lines with matches, in order. */
+    int hit_count, hit_cap;
+    SDL_atomic_t done;
+};
+
+/* A count running on the worker threads. */
+struct IsearchScan {
+    struct SearchPattern pat;
+    struct IsearchChunk *chunks;
+    int chunk_count;
+    int merged;                       /* Chunks already added to the count. */
+    SDL_atomic_t pending;             /* Chunks that haven't finished. */
+    SDL_atomic_t cancel;
+};
+
 struct Isearch {
     char str[512];
+
+    /* Matches after point are only counted. The ones on screen are found
+       again and highlighted when they're drawn. Only the lines they're on
+       are kept, so that extending the query counts again on just those. */
+    bool marking;
+    struct SearchPattern pat;         /* What's being marked. */
+    int match_count;
+    struct IsearchMatch first;        /* First match after point, which stands out. NULL line if none (yet). */
+    struct IsearchScan *scan;         /* Non-null while the workers are still counting. */
+    struct Line **hits;               /* Lines with matches after point, once the count is done. */
+    int hit_count, hit_cap;
+
+    /* Marking the same query from the same point in the same version of
+       the buffer again does nothing. */
+    bool cache_valid;
+    unsigned cached_version;
+    struct Point cached_point;
+
+    /* What the on-screen highlights were made from. */
+    bool shown_valid;
+    struct Line *shown_line;
+    int shown_rows, shown_col;
+    unsigned shown_version;
 };
 
 void buffer_isearch_goto_matching(struct Buffer *buf, char *str);
 void buffer_isearch_mark_matching(struct Buffer *buf, char *str);
+void isearch_invalidate(struct Isearch *search);
+void isearch_unmark(struct Buffer *buf);
+void isearch_mark_visible(struct Buffer *buf, struct Line *line, int rows);
+void isearch_stop_scans(struct Buffer *buf);
+bool buffer_regex_goto_matching(struct Buffer *buf, struct Regex *re);
 
 #endif /* ISEARCH_H_ */
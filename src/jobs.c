@@ -0,0 +1,136 @@
+#include "jobs.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "util.h"
+
+#define MAX_WORKERS 16
+
+struct Job {
+    void *group;              /* Whoever submitted it, so they can take back jobs that haven't started. */
+    void (*run)(void *data);
+    void *data;
+    struct Job *next;
+};
+
+Uint32 job_event = (Uint32)-1;
+
+static SDL_Thread *workers[MAX_WORKERS];
+static int worker_count = 0;
+
+static SDL_mutex *lock = NULL;
+static SDL_cond *cond = NULL;
+static struct Job *head = NULL, *tail = NULL;
+static bool quitting = false;
+
+static int jobs_worker(void *unused) {
+    (void)unused;
+    while (true) {
+        struct Job *job;
+
+        SDL_LockMutex(lock);
+        while (!head && !quitting) SDL_CondWait(cond, lock);
+        if (quitting) {
+            SDL_UnlockMutex(lock);
+            return 0;
+        }
+        job = head;
+        head = job->next;
+        if (!head) tail = NULL;
+        SDL_UnlockMutex(lock);
+
+        job->run(job->data);
+        dealloc(job);
+    }
+}
+
+/* Leaves one core for the UI thread. */
+void jobs_init() {
+    int i;
+
+    job_event = SDL_RegisterEvents(1);
+    lock = SDL_CreateMutex();
+    cond = SDL_CreateCond();
+
+    worker_count = SDL_GetCPUCount() - 1;
+    if (worker_count < 1) worker_count = 1;
+    if (worker_count > MAX_WORKERS) worker_count = MAX_WORKERS;
+
+    for (i = 0; i < worker_count; i++) {
+        workers[i] = SDL_CreateThread(jobs_worker, "ame worker", NULL);
+    }
+}
+
+/* Jobs that haven't started yet are dropped. */
+void jobs_quit() {
+    int i;
+
+    SDL_LockMutex(lock);
+    quitting = true;
+    SDL_CondBroadcast(cond);
+    SDL_UnlockMutex(lock);
+
+    for (i = 0; i < worker_count; i++) {
+        SDL_WaitThread(workers[i], NULL);
+    }
+    while (head) {
+        struct Job *next = head->next;
+        dealloc(head);
+        head = next;
+    }
+    tail = NULL;
+
+    SDL_DestroyCond(cond);
+    SDL_DestroyMutex(lock);
+}
+
+int jobs_worker_count() {
+    return worker_count;
+}
+
+void jobs_submit(void *group, void (*run)(void *data), void *data) {
+    struct Job *job = alloc(1, sizeof(struct Job));
+    job->group = group;
+    job->run = run;
+    job->data = data;
+
+    SDL_LockMutex(lock);
+    if (tail) tail->next = job;
+    else      head = job;
+    tail = job;
+    SDL_CondSignal(cond);
+    SDL_UnlockMutex(lock);
+}
+
+/* Takes back every job of the group that hasn't started yet.
+   Returns how many there were. */
+int jobs_remove_group(void *group) {
+    struct Job **j, *prev = NULL;
+    int amt = 0;
+
+    SDL_LockMutex(lock);
+    for (j = &head; *j; ) {
+        if ((*j)->group == group) {
+            struct Job *job = *j;
+            *j = job->next;
+            dealloc(job);
+            amt++;
+        } else {
+            prev = *j;
+            j = &(*j)->next;
+        }
+    }
+    tail = prev;
+    SDL_UnlockMutex(lock);
+
+    return amt;
+}
+
+/* Safe to call from any thread. */
+void jobs_notify() {
+    SDL_Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = job_event;
+    SDL_PushEvent(&event);
+}
@@ -0,0 +1,20 @@
+#ifndef JOBS_H_
+#define JOBS_H_
+
+/* A small pool of worker threads for work that's too slow to do on the
+   UI thread, like searching huge buffers. Jobs run in the order they
+   were submitted. Workers call jobs_notify() to wake the main loop up
+   with a job_event once they have results for it. */
+
+#include <SDL2/SDL.h>
+
+extern Uint32 job_event;
+
+void jobs_init();
+void jobs_quit();
+int  jobs_worker_count();
+void jobs_submit(void *group, void (*run)(void *data), void *data);
+int  jobs_remove_group(void *group);
+void jobs_notify();
+
+#endif /* JOBS_H_ */
@@ -11,6 +11,14 @@
 #include "minibuffer.h"
 #include "util.h"
 #include "panel.h"
+#include "jobs.h"
+#include "occur.h"
+#include "grep.h"
+#include "highlight.h"
+#include "watch.h"
+#include "session.h"
+#include "finder.h"
+#include "trace.h"
 
 int main(int argc, char **argv) {
     bool running = true;
@@ -23,8 +31,11 @@ int main(int argc, char **argv) {
         strcpy(buffer_name, "*scratch*");
     }
 
-    SDL_Init(SDL_INIT_VIDEO);
+    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER);
     TTF_Init();
+    trace_init(); /* Before any thread that might trace. */
+    jobs_init();
+    watch_init();
 
     window = SDL_CreateWindow("ame",
                               SDL_WINDOWPOS_UNDEFINED,
@@ -39,35 +50,61 @@ int main(int argc, char **argv) {
     font = TTF_OpenFont("consola.ttf", 19);
     TTF_SizeText(font, " ", &font_w, &font_h);
 
-    headbuf = buffer_allocate(buffer_name);
-    if (argc == 2) {
-        buffer_load_file(headbuf, file_name);
-    }
-    curbuf = headbuf;
-
     minibuffer_allocate();
     prevbuf = minibuf;
 
-    panel_left = curbuf;
-    panel_right = NULL;
+    if (!session_restore()) {
+        headbuf = buffer_allocate(buffer_name);
+        if (argc == 2) {
+            buffer_load_file(headbuf, file_name);
+        }
+        curbuf = headbuf;
+
+        panel_left = curbuf;
+        panel_right = NULL;
+    } else if (argc == 2) {
+        /* Open the file on top of the session, unless it's already in it. */
+        char absolute_path[BUF_NAME_LEN] = {0};
+        _fullpath(absolute_path, file_name, BUF_NAME_LEN);
+
+        curbuf = buffer_find_file(absolute_path);
+        if (!curbuf) {
+            curbuf = buffer_allocate(buffer_name);
+            buffer_load_file(curbuf, file_name);
+            curbuf->next = headbuf;
+            headbuf->prev = curbuf;
+            headbuf = curbuf;
+        }
+        if (panel_left == panel_right) panel_right = NULL;
+        panel_left = curbuf;
+        panel_left->curview = 0;
+        session_load_buffer(curbuf);
+    }
 
     printf("Font width: %d, Font height: %d\n", font_w, font_h);
 
-    Uint32 start = 0;
+    Uint32 last_frame = SDL_GetTicks();
 
     while (running) {
         SDL_Event event;
-        start = SDL_GetPerformanceCounter();
-
+        Uint32 now = SDL_GetTicks();
         int is_event;
 
-        int is_scroll = buffer_is_scrolling(curbuf);
-        if (animated_highlights_active || is_scroll) {
-            is_event = SDL_PollEvent(&event);
+        /* Sleep until something happens, or until the next frame is due
+           while a flash is fading or a view is scrolling. */
+        bool animating = highlights_animating(now) || buffer_is_scrolling(curbuf) || finder_ranking();
+        if (animating) {
+            Uint32 interval = max_fps > 0 ? 1000 / max_fps : 0;
+            Uint32 since = now - last_frame;
+            if (since >= interval) {
+                is_event = SDL_PollEvent(&event);
+            } else {
+                is_event = SDL_WaitEventTimeout(&event, interval - since);
+            }
         } else {
             is_event = SDL_WaitEvent(&event);
         }
-        int did_do_event = is_event;
+        int did_do_event = 0;
 
         while (is_event) {
             mouse = SDL_GetMouseState(&mx, &my);
@@ -75,6 +112,14 @@ int main(int argc, char **argv) {
                 running = false;
                 goto end_of_running_loop;
             }
+            if (event.type == watch_event) {
+                /* Checks that find nothing changed don't cost a frame. */
+                if (watch_check()) did_do_event = 1;
+                is_event = SDL_PollEvent(&event);
+                continue;
+            }
+            did_do_event = 1;
+            trace_begin("event");
             if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_RESIZED) {
                 window_width = event.window.data1;
                 window_height = event.window.data2;
@@ -89,49 +134,48 @@ int main(int argc, char **argv) {
                 }
             }
 
-            buffer_handle_input(curbuf, &event);
+            if (event.type == job_event) {
+                occur_collect();
+                grep_collect();
+                finder_collect();
+            } else {
+                session_load_buffer(curbuf);
+                trace_begin("buffer_handle_input");
+                buffer_handle_input(curbuf, &event);
+                trace_end();
+            }
             
             minibuffer_handle_input(&event);
+            trace_end();
 
             is_event = SDL_PollEvent(&event);
         }
-        if (did_do_event || is_scroll || animated_highlights_active) {
-            SDL_SetRenderDrawColor(renderer, BG.r, BG.g, BG.b, 255);
-            SDL_RenderClear(renderer);
-
-            char cwd[256] = {0};
-            get_cwd(cwd);
+        if (did_do_event || animating) {
+            trace_begin("frame");
+            finder_continue();
 
-            char curdir[256] = {0};
-            isolate_directory(curdir, curbuf->filename);
+            now = SDL_GetTicks();
+            dt = now - last_frame;
+            last_frame = now;
 
-            if (curbuf != minibuf && 0 != strcmp(cwd, curdir)) {
-                chdir(curdir);
-            }
+            SDL_SetRenderDrawColor(renderer, BG.r, BG.g, BG.b, 255);
+            SDL_RenderClear(renderer);
 
+            trace_begin("buffers_draw");
             buffers_draw();    
+            trace_end();
 
             SDL_RenderPresent(renderer);
-
-            /* dt = ~1 ms. We want to scale the speed of the lerp to the frametime. */
-
-/*            
-            curbuf->scroll.y = damp(curbuf->scroll.y, curbuf->scroll.target_y, 0.000001, dt);
-            curbuf->scroll.x = damp(curbuf->scroll.x, curbuf->scroll.target_x, 0.000001, dt);
-
-            prevbuf->scroll.y = damp(prevbuf->scroll.y, prevbuf->scroll.target_y, 0.000001, dt);
-            prevbuf->scroll.x = damp(prevbuf->scroll.x, prevbuf->scroll.target_x, 0.000001, dt);
-*/
+            trace_end();
 
             pmx = mx;
             pmy = my;
-
-            Uint32 end = SDL_GetPerformanceCounter();
-            dt = (double)(1000*(end-start)) / SDL_GetPerformanceFrequency();
         }
   end_of_running_loop:;
     }
 
+    session_save();
+
     struct Buffer *buf = headbuf;
     while (buf) {
         struct Buffer *next = buf->next;
@@ -139,6 +183,10 @@ int main(int argc, char **argv) {
         buf = next;
     }
     minibuffer_deallocate();
+    watch_quit();
+    jobs_quit(); /* After the buffers, which wait for their searches to stop. */
+    trace_quit();
+    alloc_report(ALLOC_REPORT_FILE); /* Last, so what's still live leaked. */
 
     TTF_CloseFont(font);
 
@@ -48,56 +48,54 @@ void mark_unset(struct Mark *mark) {
     mark->shift_select = false;
 }
 
+/* Copies the region in one pass. */
 char *mark_get_text(struct Mark *mark) {
     struct Line *line;
-    char *text = alloc(mark_get_length(mark), sizeof(char));
+    char *text;
+    int len = 0;
 
     mark_swap_ends_if(mark);
-    for (line = mark->start->line; line != mark->end->line->next; line = line->next, strcat(text, (char[2]){'\n',0})) {
+    text = alloc(mark_get_length(mark), sizeof(char));
+
+    for (line = mark->start->line; line != mark->end->line->next; line = line->next) {
         int x = 0, e = line->len;
         if (line == mark->start->line) {
             x = mark->start->pos;
-            e = line->len;
         }
         if (line == mark->end->line) {
             e = mark->end->pos;
         }
-        for (; x < e; x++) {
-            strcat(text, (char[2]){line->str[x], 0});
-        }
+        memcpy(text + len, line->str + x, e-x);
+        len += e-x;
+        if (line != mark->end->line) text[len++] = '\n';
     }
-    /* Remove trailing 0. */
-    text[strlen(text)-1] = 0;
+    text[len] = 0;
 
     return text;
 }
 
+/* Bytes needed to hold the region's text, including the terminating 0. */
 int mark_get_length(struct Mark *mark) {
     struct Line *line;
     int len = 0;
+
+    mark_swap_ends_if(mark);
     for (line = mark->start->line; line != mark->end->line->next; line = line->next) {
         int x = 0, e = line->len;
         if (line == mark->start->line) {
             x = mark->start->pos;
-            e = line->len;
         }
         if (line == mark->end->line) {
             e = mark->end->pos;
         }
-        len += e-x + 2; /* +2 for \n and \0 */
+        len += e-x + 1; /* +1 for \n, or the \0 on the last line */
     }
     return len;
 }
 
 void mark_delete_text(struct Mark *mark) {
-    struct Point *buf_point = &mark->buf->views[mark->buf->curview].point;
-    *buf_point = *mark->end;
-    while (true) {
-        buffer_backspace(mark->buf);
-        if (buf_point->line == mark->start->line && buf_point->pos == mark->start->pos) {
-            break;
-        }
-    }
+    mark_swap_ends_if(mark);
+    buffer_delete_region(mark->buf, *mark->start, *mark->end);
 }
 
 void mark_cut_text(struct Mark *mark) {
@@ -119,54 +117,29 @@ void mark_draw(struct Mark *mark) {
     if (!mark->start->line || !mark->end->line) return;
 
     mark_swap_ends_if(mark);
-    yoff = mark->start->line->y;
+    yoff = line_row(mark->start->line, 0);
 
     SDL_SetRenderDrawColor(renderer, 64, 85, 200, 255);
     for (line = mark->start->line; line != mark->end->line->next; line = line->next) {
-        int x = 0, w = line->len;
+        int x, w, rows = line_rows(line);
 
         int pos = yoff*SPACING + yoff*font_h;
-        if (pos < -font_h - scroll->y || pos >= window_height - scroll->y) { /* Culling */
-            yoff++;
+        if (pos + (rows-1)*(font_h+SPACING) < -font_h - scroll->y || pos >= window_height - scroll->y) { /* Culling */
+            yoff += rows;
             continue;
         }
-        if (line == mark->start->line) {
-            x = mark->start->pos;
-            w = line->len - x;
-        }
-        if (line == mark->end->line) {
-            w = mark->end->pos - x;
-        }
-        x += strlen(line->pre_str);
-
-        int tab_offset = 0;
-        int tab_width_offset = 0;
-                
-        if (line == mark->start->line && line != mark->end->line) {
-            int i;
-            for (i = 0; i < line->len; i++) {
-                if (line->str[i] == '\t') tab_width_offset += font_w * (4-1);
-            }
-        } else if (line == mark->end->line) {
-            int i;
-            for (i = 0; i < mark->end->pos; i++) {
-                if (line->str[i] == '\t') tab_width_offset += font_w * (4-1);
-            }
-        } else {
-            int i;
-            for (i = 0; i < line->len; i++) {
-                if (line->str[i] == '\t') tab_width_offset += font_w * 3;
-            }
-        }
-
-        SDL_Rect selection = {
-            tab_offset + mark->buf->x + scroll->x + SPACING + x * font_w, 
-            mark->buf->y + scroll->y + pos-SPACING,
-            tab_width_offset + w * font_w, 
-            font_h + SPACING*2
-        };
-        SDL_RenderFillRect(renderer, &selection);
-        yoff++;
+        int start = 0, end = line->len;
+        if (line == mark->start->line) start = mark->start->pos;
+        if (line == mark->end->line) end = mark->end->pos;
+
+        x = line_visual_col(line, start);
+        w = line_visual_col(line, end) - x;
+
+        wrap_fill_cols(line, x, x + w, 
+                       mark->buf->x + scroll->x + SPACING + strlen(line->pre_str) * font_w, 
+                       mark->buf->y + scroll->y + pos-SPACING, 
+                       font_h + SPACING*2);
+        yoff += rows;
     }
 }
 
@@ -7,11 +7,21 @@
 #include "panel.h"
 #include "isearch.h"
 #include "replace.h"
-
-#include <dirent.h>
+#include "occur.h"
+#include "grep.h"
+#include "watch.h"
+#include "complete.h"
+#include "finder.h"
+#include "trace.h"
 
 struct Buffer *minibuf;
 
+static char last_regex[1024] = {0}; /* Pre-filled the next time we do a regex search. */
+static char grep_query[SEARCH_MAX_LEN] = {0}; /* Kept while asking for the directory. */
+static bool showing_message = false;
+static int completion_count = 0; /* Matches in the ranking TAB is cycling through. */
+static Uint32 message_time = 0;
+
 void minibuffer_allocate() {
     minibuf = buffer_allocate("*minibuffer*");
     minibuf->x = 0;
@@ -21,6 +31,7 @@ void minibuffer_allocate() {
 }
 
 void minibuffer_deallocate() {
+    complete_free();
     buffer_deallocate(minibuf);
 }
 
@@ -35,6 +46,13 @@ void minibuffer_handle_input(SDL_Event *event) {
         buffer_isearch_mark_matching(prevbuf, minibuf->start_line->str);
     }
 
+    /* Messages stay up until the next key, not counting the one that showed it. */
+    if (showing_message && curbuf != minibuf && event->common.timestamp > message_time &&
+        (event->type == SDL_KEYDOWN || event->type == SDL_TEXTINPUT)) {
+        showing_message = false;
+        minibuffer_reset();
+    }
+
     if (event->type == SDL_TEXTINPUT) {
         buffer_reset_completion(minibuf);
     }
@@ -57,21 +75,35 @@ void minibuffer_handle_input(SDL_Event *event) {
                     curbuf = minibuf;
                     minibuf->singular_state = STATE_LOAD_FILE;
                     strcpy(minibuf->start_line->pre_str, "Open File: ");
-                    /* add cwd by default */
-                    char cwd[256] = {0};
-                    get_cwd(cwd);
-                    line_type_string(minibuf->start_line, 0, cwd);
+                    /* Add the buffer's directory by default. */
+                    line_type_string(minibuf->start_line, 0, prevbuf->directory);
                     minibuf_point->pos = minibuf->start_line->len;
+                } else if (is_alt() && !curbuf->is_singular) {
+                    prevbuf = curbuf;
+                    curbuf = minibuf;
+                    if (is_shift()) {
+                        minibuf->singular_state = STATE_OCCUR_ALL;
+                        strcpy(minibuf->start_line->pre_str, "Occur in all buffers: ");
+                    } else {
+                        minibuf->singular_state = STATE_OCCUR;
+                        strcpy(minibuf->start_line->pre_str, "Occur: ");
+                    }
                 }
                 break;
             }
             case SDLK_f: {
-                if (is_ctrl()) {
+                if (is_ctrl() && is_shift() && !curbuf->is_singular) {
+                    prevbuf = curbuf;
+                    curbuf = minibuf;
+                    minibuf->singular_state = STATE_GREP;
+                    strcpy(minibuf->start_line->pre_str, "Find in files: ");
+                } else if (is_ctrl()) {
                     if (!curbuf->is_singular) {
                         prevbuf = curbuf;
                         curbuf = minibuf;
                         minibuf->singular_state = STATE_ISEARCH;
                         strcpy(minibuf->start_line->pre_str, "Isearch: ");
+                        isearch_invalidate(buffer_curr_search(prevbuf));
                         if (strlen(prevbuf->views[prevbuf->curview].search->str)) {
                             line_type_string(minibuf->start_line, 0, prevbuf->views[prevbuf->curview].search->str);
                             minibuf->destructive = true;
@@ -80,19 +112,40 @@ void minibuffer_handle_input(SDL_Event *event) {
                     } else {
                         /* Go to the first match, then move one position ahead if possible, then mark the new matches. */
                         buffer_isearch_goto_matching(prevbuf, minibuf->start_line->str);
-                        prevbuf->views[prevbuf->curview].point.pos++;
+                        struct Point *point = &prevbuf->views[prevbuf->curview].point;
+                        point->pos = utf8_next(point->line->str, point->line->len, point->pos);
                         if (prevbuf->views[prevbuf->curview].point.pos >= prevbuf->views[prevbuf->curview].point.line->len && prevbuf->views[prevbuf->curview].point.line->next) {
                             prevbuf->views[prevbuf->curview].point.line = prevbuf->views[prevbuf->curview].point.line->next;
                         }
                         buffer_isearch_mark_matching(prevbuf, minibuf->start_line->str);
                     }
+                } else if (is_alt() && !curbuf->is_singular) {
+                    prevbuf = curbuf;
+                    curbuf = minibuf;
+                    minibuf->singular_state = STATE_REGEX_SEARCH;
+                    strcpy(minibuf->start_line->pre_str, "Regex search: ");
+                    if (strlen(last_regex)) {
+                        line_type_string(minibuf->start_line, 0, last_regex);
+                        minibuf->destructive = true;
+                    }
+                    minibuf_point->pos = minibuf->start_line->len;
+                }
+                break;
+            }
+
+            case SDLK_r: {
+                if (!curbuf->is_singular && !curbuf->read_only && is_ctrl()) {
+                    prevbuf = curbuf;
+                    curbuf = minibuf;
+                    minibuf->singular_state = STATE_REGEX_FIND;
+                    strcpy(minibuf->start_line->pre_str, "Regex Find: ");
                 }
                 break;
             }
             
             case SDLK_h: {
                 if (!curbuf->is_singular) {
-                    if (is_ctrl()) {
+                    if (is_ctrl() && !curbuf->read_only) {
                         prevbuf = curbuf;
                         curbuf = minibuf;
                         minibuf->singular_state = STATE_FIND;
@@ -111,8 +164,19 @@ void minibuffer_handle_input(SDL_Event *event) {
                 break;
             }
             
+            case SDLK_p: {
+                if (is_ctrl() && !curbuf->is_singular) {
+                    prevbuf = curbuf;
+                    curbuf = minibuf;
+                    minibuf->singular_state = STATE_FIND_FILE;
+                    strcpy(minibuf->start_line->pre_str, "Find file: ");
+                    finder_open(prevbuf);
+                }
+                break;
+            }
+
             case SDLK_q: {
-                if (!curbuf->is_singular && is_ctrl()) {
+                if (!curbuf->is_singular && !curbuf->read_only && is_ctrl()) {
                     prevbuf = curbuf;
                     curbuf = minibuf;
                     minibuf->singular_state = STATE_QUERY_FIND;
@@ -135,10 +199,8 @@ void minibuffer_handle_input(SDL_Event *event) {
                     curbuf = minibuf;
                     minibuf->singular_state = STATE_SAVE_FILE_AS;
                     strcpy(minibuf->start_line->pre_str, "Save File As: ");
-                    /* Add CWD by default. */
-                    char cwd[256] = {0};
-                    get_cwd(cwd);
-                    line_type_string(minibuf->start_line, 0, cwd);
+                    /* Add the buffer's directory by default. */
+                    line_type_string(minibuf->start_line, 0, prevbuf->directory);
                     minibuf_point->pos = minibuf->start_line->len;
                 }
                 break;
@@ -202,14 +264,7 @@ void minibuffer_handle_input(SDL_Event *event) {
                 if (is_ctrl()) {
                     mark_unset(minibuf->views[minibuf->curview].mark);
                     minibuffer_return();
-
-                    struct Line *line;
-                    /* Destroy previous highlights. */
-                    for (line = curbuf->views[curbuf->curview].point.line; line; line = line->next) {
-                        int i, c = line->hl_count;
-                        for (i = 0; i < c; i++)
-                            highlight_stop(&line->hls[i]);
-                    }
+                    isearch_unmark(curbuf);
                 } else if (is_alt()) {
                     prevbuf = curbuf;
                     curbuf = minibuf;
@@ -225,6 +280,29 @@ void minibuffer_handle_input(SDL_Event *event) {
                     if (!is_panel_left(curbuf)) panel_left = NULL;
                 } break;
             }
+            case SDLK_z: {
+                if (is_alt()) {
+                    struct Buffer *buf;
+                    int i;
+                    soft_wrap = !soft_wrap;
+                    /* Wrapped lines never scroll sideways. */
+                    for (buf = headbuf; buf; buf = buf->next) {
+                        for (i = 0; i < buf->view_count; i++) {
+                            buf->views[i].scroll.x = buf->views[i].scroll.target_x = 0;
+                        }
+                    }
+                    minibuffer_message(soft_wrap ? "Soft wrap on." : "Soft wrap off.");
+                } break;
+            }
+            case SDLK_m: {
+                if (is_alt()) {
+#ifdef ALLOC_PROFILE
+                    minibuffer_message(alloc_report(ALLOC_REPORT_FILE) ? "Wrote " ALLOC_REPORT_FILE "." : "Couldn't write " ALLOC_REPORT_FILE ".");
+#else
+                    minibuffer_message("Allocation profiling needs a build with -DALLOC_PROFILE.");
+#endif
+                } break;
+            }
             case SDLK_e: {
                 if (is_alt() && panel_left && panel_right) {
                     if (is_panel_left(curbuf)) panel_left = NULL;
@@ -234,10 +312,15 @@ void minibuffer_handle_input(SDL_Event *event) {
         }
     }
     line_update_texture(minibuf->start_line);
+
+    /* Find file ranks as you type. */
+    if (curbuf == minibuf && minibuf->singular_state == STATE_FIND_FILE) {
+        finder_update(minibuf->start_line->str);
+    }
 }
 
 /* Take the command from minibuffer, split it by space, then parse. */
-int minibuffer_execute() {
+static int minibuffer_execute_command() {
     char *command = minibuf->start_line->str;
     struct Point *minibuf_point = &minibuf->views[0].point;
 
@@ -245,32 +328,36 @@ int minibuffer_execute() {
     switch (minibuf->singular_state) {
         case STATE_LOAD_FILE: {
             /* Create a new buffer, load file, then add it to the linked list of buffers. */
-            if (!strchr(command, '\\') && !strchr(command, '/')) return 0;
+            if (!strlen(command)) return 0;
 
             struct Buffer *buf;
             char buffer_name[256];
+            char path[BUF_NAME_LEN*2] = {0};
+            char absolute_path[BUF_NAME_LEN] = {0};
 
             int was_same = panel_left == panel_right;
+
+            /* Relative paths are relative to the buffer we came from, not the process. */
+            resolve_path(path, prevbuf->directory, command);
+            _fullpath(absolute_path, path, BUF_NAME_LEN);
             
             /* Check if file already exists in opened buffers. If so, switch to it. */
-            struct Buffer *a;
-            for (a = headbuf; a; a = a->next) {
-                if (0==strcmp(a->filename, command)) {
-                    if (is_panel_left(prevbuf)) {
-                        panel_left = a;
-                        panel_left->curview = 0;
-                        if (was_same) panel_right->curview = 1;
-                    } else {
-                        panel_right = a;
-                        panel_left->curview = 0;
-                        if (was_same) panel_left->curview = 0;
-                    }
-                    prevbuf = a;
-                    goto end;
+            struct Buffer *a = buffer_find_file(absolute_path);
+            if (a) {
+                if (is_panel_left(prevbuf)) {
+                    panel_left = a;
+                    panel_left->curview = 0;
+                    if (was_same) panel_right->curview = 1;
+                } else {
+                    panel_right = a;
+                    panel_left->curview = 0;
+                    if (was_same) panel_left->curview = 0;
                 }
+                prevbuf = a;
+                goto end;
             }
 
-            remove_directory(buffer_name, command);
+            remove_directory(buffer_name, absolute_path);
             buf = buffer_allocate(buffer_name);
             if (is_panel_left(prevbuf)) {
                 panel_left = buf;
@@ -282,9 +369,9 @@ int minibuffer_execute() {
                 if (was_same) panel_left->curview = 0;
             }
 
-            int directory_exists = !buffer_load_file(buf, command);
+            int directory_exists = !buffer_load_file(buf, absolute_path);
             if (!directory_exists) {
-                strcpy(buf->filename, command);
+                buffer_set_filename(buf, absolute_path);
                 printf("New file name: %s\n", buf->filename);
             }
 
@@ -297,8 +384,9 @@ int minibuffer_execute() {
         }
         case STATE_SAVE_FILE_AS: {
             /* Save file to dir given. */
-            strcpy(prevbuf->filename, command);
-            remove_directory(prevbuf->name, command);
+            char path[BUF_NAME_LEN*2] = {0};
+            resolve_path(path, prevbuf->directory, command);
+            buffer_set_filename(prevbuf, path);
 
             buffer_save(prevbuf);
             break;
@@ -315,9 +403,13 @@ int minibuffer_execute() {
         }
         case STATE_REPLACE: {
             if (strlen(command) >= 1024) return 0;
+            char msg[64];
             strcpy(replace, command);
-            buffer_replace_matching(prevbuf, find, replace, true);
-            break;
+            int amt = buffer_replace_matching(prevbuf, find, replace, true);
+            minibuffer_return();
+            sprintf(msg, "Replaced %d occurrence%s", amt, amt == 1 ? "" : "s");
+            minibuffer_message(msg);
+            return 0;
         }
         case STATE_QUERY_FIND: {
             if (strlen(command) >= 1024) return 0;
@@ -371,40 +463,48 @@ int minibuffer_execute() {
 
             if (!match) {
                 /* Destroy previous highlights upon exit */
-                struct Line *line;
-                for (line = prevbuf->views[prevbuf->curview].point.line; line; line = line->next) {
-                    int i, c = line->hl_count;
-                    for (i = 0; i < c; i++)
-                        highlight_stop(&line->hls[i]);
-                }
+                isearch_unmark(prevbuf);
                 break;
             } else {
                 return 0;
             }
         }
         case STATE_SWITCH_TO_BUFFER: {
-            struct Buffer *buf = headbuf;
-            while (buf) {
-                if (0==strcmp(buf->name, command)) {
-                    int isleft = is_panel_left(prevbuf);
-                    int was_same = panel_left == panel_right;
-                    if (isleft) {
-                        panel_left = buf;
-                        panel_left->curview = 0;
-                        if (was_same) panel_right->curview = 1;
-                    } else {
-                        panel_right = buf;
-                        panel_left->curview = 1;
-                        if (was_same) panel_left->curview = 0;
-                    }
-                    prevbuf = buf; /* When minibuffer_return() is called, curbuf will be set to prevbuf. */
-                    break;
+            struct Buffer *buf = registry_find_name(command);
+            if (buf && buf != minibuf) {
+                int isleft = is_panel_left(prevbuf);
+                int was_same = panel_left == panel_right;
+                if (isleft) {
+                    panel_left = buf;
+                    panel_left->curview = 0;
+                    if (was_same) panel_right->curview = 1;
+                } else {
+                    panel_right = buf;
+                    panel_left->curview = 1;
+                    if (was_same) panel_left->curview = 0;
                 }
-                buf = buf->next;
+                prevbuf = buf; /* When minibuffer_return() is called, curbuf will be set to prevbuf. */
             }
             /* If we reach here then there is no matching buffer. Create a new buffer. */
             break;
         }
+        case STATE_FIND_FILE: {
+            struct Buffer *buf = finder_accept(prevbuf);
+            int was_same = panel_left == panel_right;
+
+            if (!buf) return 0;
+            if (is_panel_left(prevbuf)) {
+                panel_left = buf;
+                panel_left->curview = 0;
+                if (was_same) panel_right->curview = 1;
+            } else {
+                panel_right = buf;
+                panel_right->curview = 1;
+                if (was_same) panel_left->curview = 0;
+            }
+            prevbuf = buf;
+            break;
+        }
         case STATE_KILL_CURRENT_BUFFER: {
             if (*command == 'y') {
                 struct Buffer *new, *buf = prevbuf;
@@ -437,24 +537,27 @@ int minibuffer_execute() {
             }
             break;
         }
-        case STATE_KILL_BUFFER: {
-            struct Buffer *buf = headbuf;
-            while (buf) {
-                if (0==strcmp(buf->name, command)) {
-                    buffer_kill(buf);
-                    break;
-                }
-                buf = buf->next;
+        case STATE_RELOAD_FILE: {
+            if (*command == 'y') {
+                buffer_reload(prevbuf);
+            } else if (*command != 'n') {
+                strcpy(minibuf->start_line->pre_str, "File changed on disk. Reload and discard changes? (y/n) [Must be y or n]: ");
+                return 0;
             }
             break;
         }
+        case STATE_KILL_BUFFER: {
+            struct Buffer *buf = registry_find_name(command);
+            if (buf && buf != minibuf) buffer_kill(buf);
+            break;
+        }
         case STATE_GOTO_LINE: {
             int line = atoi(curbuf->start_line->str) - 1;
             if (line < 0) line = 0;
             buffer_goto_line(prevbuf, line);
-            int pos = prevbuf->views[prevbuf->curview].point.line->y*SPACING + prevbuf->views[prevbuf->curview].point.line->y*font_h;
+            int pos = line_row(prevbuf->views[prevbuf->curview].point.line, 0)*SPACING + line_row(prevbuf->views[prevbuf->curview].point.line, 0)*font_h;
             if (pos < -font_h-prevbuf->views[prevbuf->curview].scroll.y || pos > window_height-prevbuf->views[prevbuf->curview].scroll.y-font_h*2) {
-                prevbuf->views[prevbuf->curview].scroll.target_y = -font_h+(window_height-font_h*2)-(SPACING*prevbuf->views[prevbuf->curview].point.line->y + prevbuf->views[prevbuf->curview].point.line->y * font_h);
+                prevbuf->views[prevbuf->curview].scroll.target_y = -font_h+(window_height-font_h*2)-(SPACING*line_row(prevbuf->views[prevbuf->curview].point.line, 0) + line_row(prevbuf->views[prevbuf->curview].point.line, 0) * font_h);
             }
             break;
         }
@@ -462,22 +565,114 @@ int minibuffer_execute() {
             buffer_isearch_goto_matching(prevbuf, minibuf->start_line->str);
             break;
         }
+        case STATE_REGEX_SEARCH: {
+            if (strlen(command) >= 1024) return 0;
+            struct Regex *re = regex_compile(command);
+            if (!re) {
+                strcpy(minibuf->start_line->pre_str, "Regex search [Invalid regex]: ");
+                line_update_texture(minibuf->start_line);
+                return 0;
+            }
+            strcpy(last_regex, command);
+            buffer_regex_goto_matching(prevbuf, re);
+            regex_free(re);
+            break;
+        }
+        case STATE_REGEX_FIND: {
+            if (strlen(command) >= 1024) return 0;
+            struct Regex *re = regex_compile(command);
+            if (!re) {
+                strcpy(minibuf->start_line->pre_str, "Regex Find [Invalid regex]: ");
+                line_update_texture(minibuf->start_line);
+                return 0;
+            }
+            regex_free(re);
+            strcpy(find, command);
+            minibuf->singular_state = STATE_REGEX_REPLACE;
+            strcpy(minibuf->start_line->pre_str, "Regex Replace: ");
+            memset(minibuf->start_line->str, 0, minibuf->start_line->cap);
+            minibuf->start_line->len = 0;
+            minibuf_point->pos = 0;
+            line_update_texture(minibuf->start_line);
+            return 0; /* Don't go to end of function, where it will reset. */
+        }
+        case STATE_OCCUR: case STATE_OCCUR_ALL: {
+            if (strlen(command) >= SEARCH_MAX_LEN) return 0;
+            struct Buffer *buf = occur_start(prevbuf, command, minibuf->singular_state == STATE_OCCUR_ALL);
+            if (!buf) break;
+            /* Results go in the other panel, which gets the focus. */
+            if (buf != prevbuf) panel_show_other(prevbuf, buf);
+            prevbuf = buf;
+            break;
+        }
+        case STATE_GREP: {
+            if (!strlen(command) || strlen(command) >= SEARCH_MAX_LEN) return 0;
+            strcpy(grep_query, command);
+            minibuf->singular_state = STATE_GREP_DIRECTORY;
+            strcpy(minibuf->start_line->pre_str, "In directory: ");
+            memset(minibuf->start_line->str, 0, minibuf->start_line->cap);
+            minibuf->start_line->len = 0;
+            line_type_string(minibuf->start_line, 0, prevbuf->directory);
+            minibuf_point->pos = minibuf->start_line->len;
+            return 0; /* Don't go to end of function, where it will reset. */
+        }
+        case STATE_GREP_DIRECTORY: {
+            struct Buffer *buf = grep_start(prevbuf, grep_query, command);
+            if (!buf) {
+                strcpy(minibuf->start_line->pre_str, "In directory [No such directory]: ");
+                line_update_texture(minibuf->start_line);
+                return 0;
+            }
+            if (buf != prevbuf) panel_show_other(prevbuf, buf);
+            prevbuf = buf;
+            break;
+        }
+        case STATE_REGEX_REPLACE: {
+            if (strlen(command) >= 1024) return 0;
+            char msg[64];
+            strcpy(replace, command);
+            struct Regex *re = regex_compile(find);
+            int amt = buffer_regex_replace_matching(prevbuf, re, replace);
+            regex_free(re);
+            minibuffer_return();
+            sprintf(msg, "Replaced %d occurrence%s", amt, amt == 1 ? "" : "s");
+            minibuffer_message(msg);
+            return 0;
+        }
     }
  end:
     minibuffer_return();
     return 0;
 }
 
+int minibuffer_execute() {
+    int result;
+    trace_begin("minibuffer_execute");
+    result = minibuffer_execute_command();
+    trace_end();
+    return result;
+}
+
 void minibuffer_return() {
     buffer_reset_completion(minibuf);
     minibuf->destructive = false;
     if (curbuf == minibuf) {
+        isearch_stop_scans(prevbuf); /* Nobody collects the results once we leave. */
         minibuffer_reset();
         curbuf = prevbuf;
         prevbuf = minibuf;
     }
 }
 
+/* Shows msg in place of the prompt while we're not in the minibuffer. */
+void minibuffer_message(const char *msg) {
+    minibuffer_reset();
+    strncpy(minibuf->start_line->pre_str, msg, sizeof(minibuf->start_line->pre_str)-1);
+    line_update_texture(minibuf->start_line);
+    showing_message = true;
+    message_time = SDL_GetTicks();
+}
+
 void minibuffer_reset() {
     struct Point *minibuf_point = &minibuf->views[0].point;
     memset(minibuf->start_line->str, 0, minibuf->start_line->cap);
@@ -492,41 +687,28 @@ void minibuffer_attempt_autocomplete(int direction) {
 
     struct Point *minibuf_point = &minibuf->views[0].point;
 
-    char possibilities[MAX_COMPLETION][256];
     int i = 0;
 
     bool is_initial = !minibuf->is_completing; /* Is this the intial completion? */
 
     switch (minibuf->singular_state) {
-        case STATE_LOAD_FILE: case STATE_SAVE_FILE_AS: {
+        case STATE_LOAD_FILE: case STATE_SAVE_FILE_AS: case STATE_GREP_DIRECTORY: {
             char dirname[256] = {0};
             char filename[256] = {0};
-            DIR *d;
-            struct dirent *dir;
 
-            isolate_directory(dirname, str);
+            /* List the directory relative to the buffer we came from. */
+            char path[BUF_NAME_LEN*2] = {0};
+            resolve_path(path, prevbuf->directory, str);
+            isolate_directory(dirname, path);
 
+            /* Rank once, then cycle through the ranking. */
             if (minibuf->is_completing) {
-                strcpy(filename, minibuf->completion_original);
+                i = completion_count;
             } else {
                 minibuf->is_completing = true;
                 remove_directory(filename, str);
                 strcpy(minibuf->completion_original, filename);
-            }
-
-            d = opendir(dirname);
-            if (d) {
-                while ((dir = readdir(d)) != NULL) {
-                    if (0==strcmp(dir->d_name, ".") || 0==strcmp(dir->d_name, "..")) continue;
-                    if (strlen(filename) == 0) {
-                        strcpy(possibilities[i++], dir->d_name);
-                        continue;
-                    }
-                    if (string_begins_with(dir->d_name, filename)) {
-                        strcpy(possibilities[i++], dir->d_name);
-                    }
-                }
-                closedir(d);
+                i = completion_count = complete_files(dirname, filename);
             }
 
             if (i == 0) return;
@@ -544,35 +726,22 @@ void minibuffer_attempt_autocomplete(int direction) {
 
             memset(minibuf->start_line->str, 0, minibuf->start_line->cap);
             minibuf->start_line->len = 0;
-            char new[256] = {0};
+            char new[BUF_NAME_LEN*3] = {0};
             strcat(new, dirname);
-            strcat(new, possibilities[minibuf->completion]);
+            strcat(new, complete_match(minibuf->completion));
             line_type_string(minibuf->start_line, 0, new);
             minibuf_point->pos = minibuf->start_line->len;
 
             break;
         }
         case STATE_SWITCH_TO_BUFFER: case STATE_KILL_BUFFER: {
-            /* If there is one option, then choose that. Otherwise print the possibilities. */
-            struct Buffer *buf;
-            int i = 0;
-
             if (minibuf->is_completing) {
-                strcpy(str, minibuf->completion_original);
+                i = completion_count;
             } else {
                 minibuf->is_completing = true;
                 strcpy(minibuf->completion_original, str);
-            }
-
-            for (buf = headbuf; buf; buf = buf->next) {
-                if (buf == prevbuf) continue; /* Obviously don't switch to the currently opened buffer. */
-                if (strlen(str) == 0) {
-                    strcpy(possibilities[i++], buf->name);
-                    continue;
-                }
-                if (string_begins_with(buf->name, str)) {
-                    strcpy(possibilities[i++], buf->name);
-                }
+                /* Obviously don't switch to the currently opened buffer. */
+                i = completion_count = complete_buffers(str, prevbuf);
             }
 
             if (i == 0) return;
@@ -590,7 +759,7 @@ void minibuffer_attempt_autocomplete(int direction) {
 
             memset(minibuf->start_line->str, 0, minibuf->start_line->cap);
             minibuf->start_line->len = 0;
-            line_type_string(minibuf->start_line, 0, possibilities[minibuf->completion]);
+            line_type_string(minibuf->start_line, 0, complete_match(minibuf->completion));
             minibuf_point->pos = minibuf->start_line->len;
             
             break;
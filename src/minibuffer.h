@@ -9,8 +9,6 @@
 
 #include "buffer.h"
 
-#define MAX_COMPLETION 512
-
 enum MinibufferState {
     STATE_NONE,
     STATE_LOAD_FILE,
@@ -18,13 +16,22 @@ enum MinibufferState {
     STATE_SWITCH_TO_BUFFER,
     STATE_KILL_BUFFER,
     STATE_KILL_CURRENT_BUFFER,
+    STATE_RELOAD_FILE,
+    STATE_FIND_FILE,
     STATE_FIND,
     STATE_REPLACE,
     STATE_QUERY_FIND,
     STATE_QUERY_REPLACE,
     STATE_QUERY,
     STATE_ISEARCH,
-    STATE_GOTO_LINE
+    STATE_GOTO_LINE,
+    STATE_REGEX_SEARCH,
+    STATE_REGEX_FIND,
+    STATE_REGEX_REPLACE,
+    STATE_OCCUR,
+    STATE_OCCUR_ALL,
+    STATE_GREP,
+    STATE_GREP_DIRECTORY
 };
 
 extern struct Buffer *minibuf;
@@ -35,6 +42,7 @@ void minibuffer_handle_input(SDL_Event *event);
 int  minibuffer_execute();
 void minibuffer_return();
 void minibuffer_reset();
+void minibuffer_message(const char *msg);
 void minibuffer_attempt_autocomplete(int direction);
 
 #endif /* MINIBUFFER_H_ */
@@ -26,7 +26,7 @@ void buffer_modeline_draw(struct Buffer *buf) {
     strcat(text, "     ");
     strcat(text, line_string);
 
-    SDL_Surface *surf = TTF_RenderText_Blended(font, text, (SDL_Color){255, 255, 255, 255});
+    SDL_Surface *surf = TTF_RenderUTF8_Blended(font, text, (SDL_Color){255, 255, 255, 255});
     SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surf);
     const SDL_Rect dst = (SDL_Rect){
         buf->x + 6, window_height + 1 - font_h*2,
@@ -0,0 +1,296 @@
+#include "occur.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "globals.h"
+#include "util.h"
+#include "trace.h"
+#include "panel.h"
+#include "jobs.h"
+#include "session.h"
+
+static struct Buffer *occur_buf = NULL;
+static struct OccurScan *scan = NULL;
+
+static struct OccurResult *results = NULL; /* Sorted by y, since lines are only ever appended. */
+static int result_count = 0, result_cap = 0;
+
+static struct Line *tail = NULL;           /* Last line of the *occur* buffer. */
+static struct Buffer *header_buf = NULL;   /* Source whose header was written last. */
+static char query[SEARCH_MAX_LEN] = {0};
+static char source_name[BUF_NAME_LEN] = {0};
+static int buffers_searched = 0;
+static bool all = false;
+static bool stopped = false;               /* A source was edited or killed mid-scan. */
+
+/* Runs on a worker thread. Nothing edits a source buffer while its chunks
+ * are running, since edits call occur_stop_scans first. */
+static void occur_chunk_run(void *data) {
+    struct OccurChunk *chunk = data;
+    struct OccurScan *scan = chunk->scan;
+    struct Line *line = chunk->first;
+    int i;
+
+    trace_begin("occur_chunk");
+    for (i = 0; i < chunk->line_count && line; i++, line = line->next) {
+        if (SDL_AtomicGet(&scan->cancel)) break;
+        if (search_find(&scan->pat, line->str, line->len, 0) < 0) continue;
+
+        if (chunk->count == chunk->cap) {
+            chunk->cap = chunk->cap ? chunk->cap*2 : 64;
+            chunk->lines = reallocate(chunk->lines, chunk->cap * sizeof(struct Line *));
+        }
+        chunk->lines[chunk->count++] = line;
+    }
+
+    /* The scan can be freed as soon as pending drops, so that's the last
+     * thing done to it. */
+    SDL_AtomicSet(&chunk->done, 1);
+    SDL_AtomicAdd(&scan->pending, -1);
+    jobs_notify();
+    trace_end();
+}
+
+static void occur_update_header() {
+    char header[SEARCH_MAX_LEN + BUF_NAME_LEN + 64];
+    char where[BUF_NAME_LEN + 32];
+
+    if (all) sprintf(where, "%d buffers", buffers_searched);
+    else     strcpy(where, source_name);
+
+    sprintf(header, "%d lines matching \"%s\" in %s%s", result_count, query, where,
+            scan ? " (searching...)" : stopped ? " (stopped early)" : "");
+    line_set_string(occur_buf->start_line, header, strlen(header));
+}
+
+static struct Line *occur_append(const char *str, int len) {
+    tail = line_insert_after(tail, str, len);
+    return tail;
+}
+
+static void occur_add_result(struct Line *source) {
+    struct OccurResult *r;
+    char *text = alloc(source->len + 16, sizeof(char));
+    int prefix = sprintf(text, "%6d: ", source->y+1);
+
+    memcpy(text + prefix, source->str, source->len);
+    occur_append(text, prefix + source->len);
+    dealloc(text);
+
+    if (result_count == result_cap) {
+        result_cap = result_cap ? result_cap*2 : 64;
+        results = reallocate(results, result_cap * sizeof(struct OccurResult));
+    }
+    r = &results[result_count++];
+    r->y = tail->y;
+    r->buf = source->buf;
+    r->line = source;
+    r->version = source->buf->version;
+    r->line_y = source->y;
+}
+
+static void occur_scan_free() {
+    int i;
+    for (i = 0; i < scan->chunk_count; i++) {
+        /* Chunks of a buffer are next to each other, and it was counted once. */
+        if (i == 0 || scan->chunks[i].buf != scan->chunks[i-1].buf) scan->chunks[i].buf->scans--;
+        dealloc(scan->chunks[i].lines);
+    }
+    dealloc(scan->chunks);
+    dealloc(scan);
+    scan = NULL;
+}
+
+static void occur_scan_cancel() {
+    SDL_AtomicSet(&scan->cancel, 1);
+    SDL_AtomicAdd(&scan->pending, -jobs_remove_group(scan));
+    /* The running ones stop after the line they're on. */
+    while (SDL_AtomicGet(&scan->pending) > 0) SDL_Delay(1);
+
+    occur_scan_free();
+}
+
+/* Starts listing the lines of buf (or every buffer) matching query. Returns
+ * the *occur* buffer, which fills in as the workers finish, or NULL if
+ * there's nothing to search. */
+struct Buffer *occur_start(struct Buffer *buf, char *q, bool all_buffers) {
+    struct Buffer *b;
+    int i;
+
+    if (!strlen(q) || buf->is_singular) return NULL;
+    if (!all_buffers && buf == occur_buf) return NULL;
+    if (scan) occur_scan_cancel();
+
+    scan = alloc(1, sizeof(struct OccurScan));
+    if (!search_compile(&scan->pat, q)) {
+        dealloc(scan);
+        scan = NULL;
+        return NULL;
+    }
+
+    if (!occur_buf) {
+        occur_buf = buffer_allocate("*occur*");
+        occur_buf->read_only = true;
+        occur_buf->on_return = occur_goto_source;
+
+        occur_buf->next = buf->next;
+        occur_buf->prev = buf;
+        if (buf->next) buf->next->prev = occur_buf;
+        buf->next = occur_buf;
+    } else {
+        buffer_clear(occur_buf);
+        result_count = 0;
+    }
+    tail = occur_buf->start_line;
+    header_buf = NULL;
+    strcpy(query, q);
+    strcpy(source_name, buf->name);
+    all = all_buffers;
+    stopped = false;
+    buffers_searched = 0;
+
+    for (b = all ? headbuf : buf; b; b = all ? b->next : NULL) {
+        if (b == occur_buf) continue;
+        session_load_buffer(b);
+        scan->chunk_count += (b->line_count + OCCUR_CHUNK_LINES-1) / OCCUR_CHUNK_LINES;
+    }
+    scan->chunks = alloc(scan->chunk_count, sizeof(struct OccurChunk));
+    SDL_AtomicSet(&scan->pending, scan->chunk_count);
+
+    i = 0;
+    for (b = all ? headbuf : buf; b; b = all ? b->next : NULL) {
+        struct Line *line = b->start_line;
+        if (b == occur_buf) continue;
+
+        while (line) {
+            struct OccurChunk *chunk = &scan->chunks[i++];
+            int j;
+            chunk->scan = scan;
+            chunk->buf = b;
+            chunk->first = line;
+            chunk->line_count = OCCUR_CHUNK_LINES;
+            for (j = 0; j < OCCUR_CHUNK_LINES && line; j++) line = line->next;
+        }
+        b->scans++;
+        buffers_searched++;
+    }
+
+    for (i = 0; i < scan->chunk_count; i++) {
+        jobs_submit(scan, occur_chunk_run, &scan->chunks[i]);
+    }
+
+    occur_update_header();
+    return occur_buf;
+}
+
+/* Writes the chunks that have finished into the *occur* buffer, in order.
+ * Called whenever a worker wakes up the main loop. */
+void occur_collect() {
+    int from;
+
+    if (!scan) return;
+    from = scan->merged;
+
+    while (scan->merged < scan->chunk_count && SDL_AtomicGet(&scan->chunks[scan->merged].done)) {
+        struct OccurChunk *chunk = &scan->chunks[scan->merged];
+        int m;
+        for (m = 0; m < chunk->count; m++) {
+            if (all && chunk->buf != header_buf) {
+                char header[BUF_NAME_LEN + 2];
+                sprintf(header, "%s:", chunk->buf->name);
+                occur_append(header, strlen(header));
+            }
+            header_buf = chunk->buf;
+            occur_add_result(chunk->lines[m]);
+        }
+        dealloc(chunk->lines);
+        chunk->lines = NULL;
+        scan->merged++;
+    }
+
+    /* A worker may still be between setting done and dropping pending. Its
+     * notify comes after, and collects again. */
+    if (scan->merged == scan->chunk_count && SDL_AtomicGet(&scan->pending) == 0) {
+        occur_scan_free();
+    } else if (scan->merged == from) {
+        return; /* Nothing new, so leave the header alone. */
+    }
+    occur_update_header();
+}
+
+/* Called before buf is edited. What's finished so far is still valid, so
+ * it's kept, and the rest of the search is dropped. */
+void occur_stop_scans(struct Buffer *buf) {
+    int i;
+
+    if (!scan) return;
+    for (i = scan->merged; i < scan->chunk_count; i++) {
+        if (scan->chunks[i].buf == buf) break;
+    }
+    if (i == scan->chunk_count) return;
+
+    occur_collect();
+    if (!scan) return;
+    occur_scan_cancel();
+    stopped = true;
+    occur_update_header();
+}
+
+/* Called when buf is about to be deallocated. */
+void occur_forget(struct Buffer *buf) {
+    int i;
+
+    if (buf == occur_buf) {
+        if (scan) occur_scan_cancel();
+        dealloc(results);
+        results = NULL;
+        result_count = result_cap = 0;
+        occur_buf = NULL;
+        tail = NULL;
+        header_buf = NULL;
+        return;
+    }
+
+    occur_stop_scans(buf);
+    for (i = 0; i < result_count; i++) {
+        if (results[i].buf == buf) results[i].buf = NULL;
+    }
+    if (header_buf == buf) header_buf = NULL;
+}
+
+/* RETURN in the *occur* buffer. Shows the source of the result at point
+ * in the other panel. */
+int occur_goto_source() {
+    int y = buffer_curr_point(occur_buf)->line->y;
+    int lo = 0, hi = result_count-1;
+    struct OccurResult *r = NULL;
+    struct Buffer *src;
+    struct Point *point;
+    struct ScrollBar *scroll;
+
+    while (lo <= hi) {
+        int mid = lo + (hi-lo)/2;
+        if (results[mid].y < y)      lo = mid+1;
+        else if (results[mid].y > y) hi = mid-1;
+        else { r = &results[mid]; break; }
+    }
+    if (!r || !r->buf) return 0;
+
+    src = r->buf;
+    panel_show_other(occur_buf, src);
+    curbuf = src;
+
+    point = buffer_curr_point(src);
+    scroll = buffer_curr_scroll(src);
+    /* Once the source is edited the line may be gone, so it's looked up by number. */
+    point->line = src->version == r->version ? r->line : buffer_line_at(src, r->line_y);
+    point->pos = 0;
+
+    int pos = line_row(point->line, point->pos)*SPACING + line_row(point->line, point->pos)*font_h;
+    if (pos < -font_h-scroll->y || pos > window_height-scroll->y-font_h*2) {
+        scroll->target_y = -font_h+(window_height/2 - font_h*2)-(SPACING*line_row(point->line, point->pos) + line_row(point->line, point->pos) * font_h);
+    }
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef OCCUR_H_
+#define OCCUR_H_
+
+#include "buffer.h"
+#include "search.h"
+
+/* Occur lists every line matching a query in a read-only *occur* buffer,
+   like emacs' M-x occur. The lines are scanned on the worker threads and
+   streamed into the buffer as chunks finish. RETURN on a result jumps to
+   the line it came from. */
+
+#define OCCUR_CHUNK_LINES 16384
+
+struct OccurChunk {
+    struct OccurScan *scan;
+    struct Buffer *buf;
+    struct Line *first;
+    int line_count;
+    struct Line **lines;      /* Matching lines. Only touched by the worker until done is set. */
+    int count, cap;
+    SDL_atomic_t done;
+};
+
+struct OccurScan {
+    struct SearchPattern pat;
+    struct OccurChunk *chunks;
+    int chunk_count;
+    int merged;               /* Chunks already written into the *occur* buffer. */
+    SDL_atomic_t pending;     /* Chunks that haven't finished. */
+    SDL_atomic_t cancel;
+};
+
+/* Where a line of the *occur* buffer came from. */
+struct OccurResult {
+    int y;                    /* Line in the *occur* buffer. */
+    struct Buffer *buf;       /* NULL once that buffer is killed. */
+    struct Line *line;        /* Only valid while buf->version == version. */
+    unsigned version;
+    int line_y;               /* Fallback if the buffer was edited since. */
+};
+
+struct Buffer *occur_start(struct Buffer *buf, char *query, bool all_buffers);
+void           occur_collect();
+void           occur_stop_scans(struct Buffer *buf);
+void           occur_forget(struct Buffer *buf);
+int            occur_goto_source();
+
+#endif /* OCCUR_H_ */
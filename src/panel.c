@@ -4,6 +4,7 @@
 #include "buffer.h"
 #include "minibuffer.h"
 #include "modeline.h"
+#include "session.h"
 
 struct Buffer *panel_left  = NULL, 
               *panel_right = NULL;
@@ -30,6 +31,10 @@ void buffers_draw() {
 
     SDL_Texture *left = NULL, *right = NULL;
 
+    /* Buffers restored from the session read their files when first shown. */
+    session_load_buffer(panel_left);
+    session_load_buffer(panel_right);
+
     left = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, window_width / panel_count(), window_height);
     if (panel_count())
         right = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, window_width / panel_count(), window_height);
@@ -129,6 +134,21 @@ void buffers_draw() {
         SDL_DestroyTexture(right);
 }
 
+/* Shows buf in the panel from isn't in, splitting the window if needed. */
+void panel_show_other(struct Buffer *from, struct Buffer *buf) {
+    int was_same = panel_left == panel_right;
+
+    if (is_panel_left(from)) {
+        panel_right = buf;
+        panel_right->curview = 1;
+        if (was_same) panel_left->curview = 0;
+    } else {
+        panel_left = buf;
+        panel_left->curview = 0;
+        if (was_same) panel_right->curview = 1;
+    }
+}
+
 int panel_count() {
     return (panel_left && panel_right) ? 2 : 1;
 }
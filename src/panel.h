@@ -5,6 +5,7 @@ extern struct Buffer *panel_left, *panel_right;
 
 void panel_swap_focus();
 void buffers_draw();
+void panel_show_other(struct Buffer *from, struct Buffer *buf);
 int panel_count();
 int is_panel_left(struct Buffer *buf);
 
@@ -0,0 +1,676 @@
+#include "regex.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+#include "util.h"
+
+/* Once this many DFA states exist the cache is thrown away and rebuilt
+   from whatever state we're in, so memory stays bounded on patterns
+   whose DFA would blow up. */
+#define MAX_DFA_STATES 2048
+#define DFA_HASH_SIZE  4096
+
+#define NCAP (REGEX_MAX_GROUPS*2)
+
+enum {
+    N_EMPTY, N_CHAR, N_ANY, N_CLASS, N_BOL, N_EOL,
+    N_CAT, N_ALT, N_STAR, N_PLUS, N_QUEST, N_GROUP
+};
+
+enum {
+    I_CHAR, I_ANY, I_CLASS, I_BOL, I_EOL,
+    I_JMP, I_SPLIT, I_SAVE, I_MATCH
+};
+
+struct Node {
+    int type;
+    int c;          /* Character, class index or group number. */
+    bool greedy;
+    int left, right;
+};
+
+struct Inst {
+    int op;
+    int c;          /* Character, class index or capture slot. */
+    int x, y;       /* Jump targets. SPLIT prefers x. */
+};
+
+struct Thread {
+    int pc;
+    int *caps;
+};
+
+struct ThreadList {
+    struct Thread *threads;
+    int *caps;
+    int count;
+};
+
+struct DfaState {
+    int *pcs;
+    int count;
+    int next[256];     /* -1 if the transition hasn't been built yet. */
+    bool match;        /* A match has ended by the time we're in this state. */
+    bool match_at_end; /* A match ends here if this is also the end of the text. */
+};
+
+struct Regex {
+    struct Inst *prog;
+    int len;
+    unsigned char (*classes)[32];
+    int class_count;
+    int groups;
+
+    /* Pike VM */
+    struct ThreadList lists[2];
+    unsigned *visited;
+    unsigned gen;
+
+    /* Lazily built DFA */
+    struct DfaState *states;
+    int state_count;
+    int hash[DFA_HASH_SIZE];
+    int start_state[2]; /* Indexed by whether we're at the beginning of the line. */
+    int *set;
+    int set_count;
+    int flushes;
+};
+
+struct Parser {
+    const char *s;
+    struct Node *nodes;
+    int node_count;
+    unsigned char (*classes)[32];
+    int class_count;
+    int groups;
+    bool error;
+};
+
+static int parse_alt(struct Parser *p);
+
+static int new_node(struct Parser *p, int type, int c, int left, int right) {
+    struct Node *n = &p->nodes[p->node_count];
+    n->type = type;
+    n->c = c;
+    n->greedy = true;
+    n->left = left;
+    n->right = right;
+    return p->node_count++;
+}
+
+static void class_add(unsigned char *set, int c) {
+    set[c >> 3] |= 1 << (c & 7);
+}
+
+static bool class_has(const unsigned char *set, int c) {
+    return set[c >> 3] & (1 << (c & 7));
+}
+
+/* Adds the set of a \d, \w or \s style escape. Returns false if it isn't one. */
+static bool class_add_escape(unsigned char *set, char e) {
+    int c;
+    bool negate = e == 'D' || e == 'W' || e == 'S';
+    unsigned char tmp[32] = {0};
+
+    switch (e) {
+        case 'd': case 'D':
+            for (c = '0'; c <= '9'; c++) class_add(tmp, c);
+            break;
+        case 'w': case 'W':
+            for (c = 0; c < 256; c++) if (isalnum(c) || c == '_') class_add(tmp, c);
+            break;
+        case 's': case 'S':
+            for (c = 0; c < 256; c++) if (isspace(c)) class_add(tmp, c);
+            break;
+        default:
+            return false;
+    }
+    for (c = 0; c < 32; c++) set[c] |= negate ? ~tmp[c] : tmp[c];
+    return true;
+}
+
+static int parse_class(struct Parser *p) {
+    unsigned char *set = p->classes[p->class_count];
+    bool negate = false;
+    int c;
+
+    if (*p->s == '^') {
+        negate = true;
+        p->s++;
+    }
+    /* A ']' right at the start is a literal. */
+    if (*p->s == ']') {
+        class_add(set, ']');
+        p->s++;
+    }
+    while (*p->s && *p->s != ']') {
+        int lo = (unsigned char)*p->s++;
+        if (lo == '\\' && *p->s) {
+            if (class_add_escape(set, *p->s)) {
+                p->s++;
+                continue;
+            }
+            lo = (unsigned char)*p->s++;
+        }
+        if (*p->s == '-' && p->s[1] && p->s[1] != ']') {
+            int hi = (unsigned char)p->s[1];
+            p->s += 2;
+            for (c = lo; c <= hi; c++) class_add(set, c);
+        } else {
+            class_add(set, lo);
+        }
+    }
+    if (*p->s != ']') {
+        p->error = true;
+        return new_node(p, N_EMPTY, 0, -1, -1);
+    }
+    p->s++;
+
+    if (negate) {
+        for (c = 0; c < 32; c++) set[c] = ~set[c];
+    }
+    return new_node(p, N_CLASS, p->class_count++, -1, -1);
+}
+
+static int parse_atom(struct Parser *p) {
+    char c = *p->s++;
+    switch (c) {
+        case '(': {
+            int group = p->groups < REGEX_MAX_GROUPS ? p->groups++ : -1;
+            int inner = parse_alt(p);
+            if (*p->s != ')') {
+                p->error = true;
+                return inner;
+            }
+            p->s++;
+            return new_node(p, N_GROUP, group, inner, -1);
+        }
+        case '[': return parse_class(p);
+        case '.': return new_node(p, N_ANY, 0, -1, -1);
+        case '^': return new_node(p, N_BOL, 0, -1, -1);
+        case '$': return new_node(p, N_EOL, 0, -1, -1);
+        case '*': case '+': case '?': case ')': {
+            p->error = true; /* Nothing to repeat, or unbalanced. */
+            return new_node(p, N_EMPTY, 0, -1, -1);
+        }
+        case '\\': {
+            if (!*p->s) {
+                p->error = true;
+                return new_node(p, N_EMPTY, 0, -1, -1);
+            }
+            c = *p->s++;
+            if (class_add_escape(p->classes[p->class_count], c)) {
+                return new_node(p, N_CLASS, p->class_count++, -1, -1);
+            }
+            if (c == 't') c = '\t';
+            return new_node(p, N_CHAR, (unsigned char)c, -1, -1);
+        }
+    }
+    return new_node(p, N_CHAR, (unsigned char)c, -1, -1);
+}
+
+static int parse_repeat(struct Parser *p) {
+    int n = parse_atom(p);
+    while (!p->error && (*p->s == '*' || *p->s == '+' || *p->s == '?')) {
+        int type = *p->s == '*' ? N_STAR : (*p->s == '+' ? N_PLUS : N_QUEST);
+        p->s++;
+        n = new_node(p, type, 0, n, -1);
+        if (*p->s == '?') {
+            p->nodes[n].greedy = false;
+            p->s++;
+        }
+    }
+    return n;
+}
+
+static int parse_cat(struct Parser *p) {
+    int n = -1;
+    while (!p->error && *p->s && *p->s != '|' && *p->s != ')') {
+        int r = parse_repeat(p);
+        n = n < 0 ? r : new_node(p, N_CAT, 0, n, r);
+    }
+    return n < 0 ? new_node(p, N_EMPTY, 0, -1, -1) : n;
+}
+
+static int parse_alt(struct Parser *p) {
+    int n = parse_cat(p);
+    while (!p->error && *p->s == '|') {
+        p->s++;
+        n = new_node(p, N_ALT, 0, n, parse_cat(p));
+    }
+    return n;
+}
+
+static int node_size(struct Node *nodes, int n) {
+    struct Node *node = &nodes[n];
+    switch (node->type) {
+        case N_EMPTY: return 0;
+        case N_CAT:   return node_size(nodes, node->left) + node_size(nodes, node->right);
+        case N_ALT:   return 2 + node_size(nodes, node->left) + node_size(nodes, node->right);
+        case N_STAR:  return 2 + node_size(nodes, node->left);
+        case N_PLUS:  return 1 + node_size(nodes, node->left);
+        case N_QUEST: return 1 + node_size(nodes, node->left);
+        case N_GROUP: return (node->c >= 0 ? 2 : 0) + node_size(nodes, node->left);
+    }
+    return 1;
+}
+
+static void emit_split(struct Inst *inst, int x, int y, bool greedy) {
+    inst->op = I_SPLIT;
+    inst->x = greedy ? x : y;
+    inst->y = greedy ? y : x;
+}
+
+/* Thompson construction, as in Russ Cox's "Regular Expression Matching: the Virtual Machine Approach". */
+static int emit(struct Regex *re, struct Node *nodes, int n, int pc) {
+    struct Node *node = &nodes[n];
+    struct Inst *prog = re->prog;
+    int start = pc;
+
+    switch (node->type) {
+        case N_EMPTY: break;
+        case N_CHAR:  prog[pc].op = I_CHAR;  prog[pc++].c = node->c; break;
+        case N_CLASS: prog[pc].op = I_CLASS; prog[pc++].c = node->c; break;
+        case N_ANY:   prog[pc++].op = I_ANY; break;
+        case N_BOL:   prog[pc++].op = I_BOL; break;
+        case N_EOL:   prog[pc++].op = I_EOL; break;
+        case N_CAT: {
+            pc = emit(re, nodes, node->left, pc);
+            pc = emit(re, nodes, node->right, pc);
+            break;
+        }
+        case N_ALT: {
+            int split = pc++, jmp;
+            pc = emit(re, nodes, node->left, pc);
+            jmp = pc++;
+            emit_split(&prog[split], split+1, pc, true);
+            pc = emit(re, nodes, node->right, pc);
+            prog[jmp].op = I_JMP;
+            prog[jmp].x = pc;
+            break;
+        }
+        case N_STAR: {
+            int split = pc++;
+            pc = emit(re, nodes, node->left, pc);
+            prog[pc].op = I_JMP;
+            prog[pc++].x = split;
+            emit_split(&prog[split], split+1, pc, node->greedy);
+            break;
+        }
+        case N_PLUS: {
+            pc = emit(re, nodes, node->left, pc);
+            emit_split(&prog[pc], start, pc+1, node->greedy);
+            pc++;
+            break;
+        }
+        case N_QUEST: {
+            int split = pc++;
+            pc = emit(re, nodes, node->left, pc);
+            emit_split(&prog[split], split+1, pc, node->greedy);
+            break;
+        }
+        case N_GROUP: {
+            if (node->c >= 0) {
+                prog[pc].op = I_SAVE;
+                prog[pc++].c = node->c*2;
+            }
+            pc = emit(re, nodes, node->left, pc);
+            if (node->c >= 0) {
+                prog[pc].op = I_SAVE;
+                prog[pc++].c = node->c*2 + 1;
+            }
+            break;
+        }
+    }
+    return pc;
+}
+
+static void next_gen(struct Regex *re) {
+    if (++re->gen == 0) {
+        memset(re->visited, 0, re->len * sizeof(unsigned));
+        re->gen = 1;
+    }
+}
+
+static void dfa_reset(struct Regex *re) {
+    int i;
+    for (i = 0; i < re->state_count; i++) {
+        dealloc(re->states[i].pcs);
+    }
+    re->state_count = 0;
+    for (i = 0; i < DFA_HASH_SIZE; i++) re->hash[i] = -1;
+    re->start_state[0] = re->start_state[1] = -1;
+}
+
+/* Returns NULL if the pattern is invalid. */
+struct Regex *regex_compile(const char *pattern) {
+    struct Parser p = {0};
+    struct Regex *re;
+    int len = strlen(pattern), root, i, pc;
+
+    p.s = pattern;
+    p.groups = 1; /* Group 0 is the whole match. */
+    p.nodes = alloc(len*3 + 2, sizeof(struct Node));
+    p.classes = alloc(len + 1, sizeof(*p.classes));
+
+    root = parse_alt(&p);
+    if (p.error || *p.s) {
+        dealloc(p.nodes);
+        dealloc(p.classes);
+        return NULL;
+    }
+
+    re = alloc(1, sizeof(struct Regex));
+    re->classes = p.classes;
+    re->class_count = p.class_count;
+    re->groups = p.groups;
+
+    /* save 0, the pattern, save 1, match. */
+    re->len = node_size(p.nodes, root) + 3;
+    re->prog = alloc(re->len, sizeof(struct Inst));
+    re->prog[0].op = I_SAVE;
+    re->prog[0].c = 0;
+    pc = emit(re, p.nodes, root, 1);
+    re->prog[pc].op = I_SAVE;
+    re->prog[pc++].c = 1;
+    re->prog[pc].op = I_MATCH;
+    dealloc(p.nodes);
+
+    for (i = 0; i < 2; i++) {
+        re->lists[i].threads = alloc(re->len, sizeof(struct Thread));
+        re->lists[i].caps = alloc(re->len * NCAP, sizeof(int));
+    }
+    re->visited = alloc(re->len, sizeof(unsigned));
+
+    re->states = alloc(MAX_DFA_STATES, sizeof(struct DfaState));
+    re->set = alloc(re->len, sizeof(int));
+    dfa_reset(re);
+
+    return re;
+}
+
+void regex_free(struct Regex *re) {
+    int i;
+    if (!re) return;
+    dfa_reset(re);
+    for (i = 0; i < 2; i++) {
+        dealloc(re->lists[i].threads);
+        dealloc(re->lists[i].caps);
+    }
+    dealloc(re->states);
+    dealloc(re->set);
+    dealloc(re->visited);
+    dealloc(re->prog);
+    dealloc(re->classes);
+    dealloc(re);
+}
+
+static bool inst_consumes(struct Regex *re, struct Inst *inst, unsigned char c) {
+    switch (inst->op) {
+        case I_CHAR:  return inst->c == c;
+        case I_ANY:   return true;
+        case I_CLASS: return class_has(re->classes[inst->c], c);
+    }
+    return false;
+}
+
+/* Epsilon closure into re->set. Consuming instructions, MATCH and
+   unresolved EOLs are kept; everything else is followed. */
+static void dfa_closure(struct Regex *re, int pc, bool bol) {
+    struct Inst *inst = &re->prog[pc];
+
+    if (re->visited[pc] == re->gen) return;
+    re->visited[pc] = re->gen;
+
+    switch (inst->op) {
+        case I_JMP:   dfa_closure(re, inst->x, bol); return;
+        case I_SPLIT: dfa_closure(re, inst->x, bol); dfa_closure(re, inst->y, bol); return;
+        case I_SAVE:  dfa_closure(re, pc+1, bol); return;
+        case I_BOL:   if (bol) dfa_closure(re, pc+1, bol); return;
+    }
+    re->set[re->set_count++] = pc;
+}
+
+/* Does following the EOLs in the set reach a MATCH? */
+static bool dfa_match_at_end(struct Regex *re, int *pcs, int count) {
+    int i, j, n = count;
+
+    next_gen(re);
+    re->set_count = 0;
+    for (i = 0; i < n; i++) {
+        if (re->prog[pcs[i]].op == I_EOL) dfa_closure(re, pcs[i]+1, false);
+    }
+    for (j = 0; j < re->set_count; j++) {
+        int op = re->prog[re->set[j]].op;
+        if (op == I_MATCH) return true;
+        if (op == I_EOL) dfa_closure(re, re->set[j]+1, false);
+    }
+    return false;
+}
+
+static int compare_ints(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+/* Finds or adds the state for re->set, or returns -1 if the cache is full. */
+static int dfa_intern(struct Regex *re) {
+    unsigned h = 2166136261u;
+    int i, slot;
+    struct DfaState *state;
+
+    qsort(re->set, re->set_count, sizeof(int), compare_ints);
+    for (i = 0; i < re->set_count; i++) {
+        h = (h ^ re->set[i]) * 16777619u;
+    }
+
+    for (slot = h % DFA_HASH_SIZE; re->hash[slot] != -1; slot = (slot+1) % DFA_HASH_SIZE) {
+        state = &re->states[re->hash[slot]];
+        if (state->count == re->set_count && 0 == memcmp(state->pcs, re->set, re->set_count * sizeof(int))) {
+            return re->hash[slot];
+        }
+    }
+    if (re->state_count == MAX_DFA_STATES) return -1;
+
+    state = &re->states[re->state_count];
+    state->count = re->set_count;
+    state->pcs = alloc(re->set_count + 1, sizeof(int));
+    memcpy(state->pcs, re->set, re->set_count * sizeof(int));
+    for (i = 0; i < 256; i++) state->next[i] = -1;
+    state->match = false;
+    for (i = 0; i < state->count; i++) {
+        if (re->prog[state->pcs[i]].op == I_MATCH) state->match = true;
+    }
+    state->match_at_end = state->match || dfa_match_at_end(re, state->pcs, state->count);
+
+    re->hash[slot] = re->state_count;
+    return re->state_count++;
+}
+
+/* Interns re->set, flushing the cache first if it's full. */
+static int dfa_intern_or_flush(struct Regex *re) {
+    int s = dfa_intern(re);
+    if (s < 0) {
+        /* dfa_intern sorted re->set already, and dfa_reset doesn't touch it. */
+        int *set = alloc(re->set_count + 1, sizeof(int));
+        int count = re->set_count;
+        memcpy(set, re->set, count * sizeof(int));
+        dfa_reset(re);
+        re->flushes++;
+        memcpy(re->set, set, count * sizeof(int));
+        re->set_count = count;
+        dealloc(set);
+        s = dfa_intern(re);
+    }
+    return s;
+}
+
+static int dfa_start(struct Regex *re, bool bol) {
+    if (re->start_state[bol] < 0) {
+        int s;
+        next_gen(re);
+        re->set_count = 0;
+        dfa_closure(re, 0, bol);
+        s = dfa_intern_or_flush(re);
+        re->start_state[bol] = s;
+    }
+    return re->start_state[bol];
+}
+
+/* Every step also restarts the pattern at the next position,
+   which is what makes the search unanchored. */
+static int dfa_step(struct Regex *re, int s, unsigned char c) {
+    struct DfaState *state = &re->states[s];
+    int i, next, flushes = re->flushes;
+
+    next_gen(re);
+    re->set_count = 0;
+    for (i = 0; i < state->count; i++) {
+        struct Inst *inst = &re->prog[state->pcs[i]];
+        if (inst_consumes(re, inst, c)) dfa_closure(re, state->pcs[i]+1, false);
+    }
+    dfa_closure(re, 0, false);
+
+    next = dfa_intern_or_flush(re);
+    if (flushes == re->flushes) {
+        state->next[c] = next; /* Otherwise the state we came from is gone. */
+    }
+    return next;
+}
+
+/* Linear scan for whether there's any match starting at or after start. */
+static bool dfa_has_match(struct Regex *re, const unsigned char *t, int len, int start) {
+    int s = dfa_start(re, start == 0);
+    int i;
+
+    for (i = start; i < len; i++) {
+        if (re->states[s].match) return true;
+        int next = re->states[s].next[t[i]];
+        s = next >= 0 ? next : dfa_step(re, s, t[i]);
+    }
+    return re->states[s].match_at_end;
+}
+
+static void pike_add(struct Regex *re, struct ThreadList *l, int pc, int *caps, int i, int len) {
+    struct Inst *inst = &re->prog[pc];
+
+    if (re->visited[pc] == re->gen) return;
+    re->visited[pc] = re->gen;
+
+    switch (inst->op) {
+        case I_JMP: pike_add(re, l, inst->x, caps, i, len); return;
+        case I_SPLIT: {
+            pike_add(re, l, inst->x, caps, i, len);
+            pike_add(re, l, inst->y, caps, i, len);
+            return;
+        }
+        case I_SAVE: {
+            int old = caps[inst->c];
+            caps[inst->c] = i;
+            pike_add(re, l, pc+1, caps, i, len);
+            caps[inst->c] = old;
+            return;
+        }
+        case I_BOL: if (i == 0)   pike_add(re, l, pc+1, caps, i, len); return;
+        case I_EOL: if (i == len) pike_add(re, l, pc+1, caps, i, len); return;
+    }
+
+    struct Thread *t = &l->threads[l->count];
+    t->pc = pc;
+    t->caps = l->caps + l->count * NCAP;
+    memcpy(t->caps, caps, NCAP * sizeof(int));
+    l->count++;
+}
+
+/* Leftmost-first match with capture groups. Only run on text the DFA
+   already said matches, so it always finds one. */
+static bool pike_run(struct Regex *re, const unsigned char *t, int len, int start, struct RegexMatch *m) {
+    struct ThreadList *clist = &re->lists[0], *nlist = &re->lists[1], *tmp;
+    int empty[NCAP];
+    bool matched = false;
+    int i, j;
+
+    for (j = 0; j < NCAP; j++) empty[j] = -1;
+
+    clist->count = 0;
+    next_gen(re);
+    pike_add(re, clist, 0, empty, start, len);
+
+    for (i = start; ; i++) {
+        if (matched && !clist->count) break;
+        nlist->count = 0;
+        next_gen(re);
+        for (j = 0; j < clist->count; j++) {
+            struct Thread *th = &clist->threads[j];
+            struct Inst *inst = &re->prog[th->pc];
+            if (inst->op == I_MATCH) {
+                int g;
+                for (g = 0; g < REGEX_MAX_GROUPS; g++) {
+                    m->start[g] = th->caps[g*2];
+                    m->end[g] = th->caps[g*2+1];
+                    if (m->start[g] < 0 || m->end[g] < 0) m->start[g] = m->end[g] = -1;
+                }
+                matched = true;
+                break; /* Lower priority threads lose. */
+            }
+            if (i < len && inst_consumes(re, inst, t[i])) {
+                pike_add(re, nlist, th->pc+1, th->caps, i+1, len);
+            }
+        }
+        if (i >= len) break;
+        if (!matched) {
+            pike_add(re, nlist, 0, empty, i+1, len);
+        }
+        tmp = clist; clist = nlist; nlist = tmp;
+    }
+    return matched;
+}
+
+/* Finds the first match at or after start. Returns 1 and fills in match if found. */
+int regex_find(struct Regex *re, const char *text, int len, int start, struct RegexMatch *match) {
+    const unsigned char *t = (const unsigned char *)text;
+    if (start > len) return 0;
+    /* Nothing left to scan, and the Pike VM gets ^ right at the end of an empty line. */
+    if (start == len) return pike_run(re, t, len, start, match);
+    if (!dfa_has_match(re, t, len, start)) return 0;
+    return pike_run(re, t, len, start, match);
+}
+
+/* Builds the replacement for a match, substituting \0-\9 with the groups. */
+char *regex_expand(const char *replacement, const char *text, const struct RegexMatch *match, int *out_len) {
+    int len = 0, cap = strlen(replacement) + 1;
+    const char *r;
+    char *out;
+
+    for (r = replacement; *r; r++) {
+        if (*r == '\\' && r[1] >= '0' && r[1] <= '9') {
+            int g = r[1] - '0';
+            if (match->start[g] >= 0) cap += match->end[g] - match->start[g];
+        }
+    }
+
+    out = alloc(cap, sizeof(char));
+    for (r = replacement; *r; r++) {
+        if (*r == '\\' && r[1]) {
+            r++;
+            if (*r >= '0' && *r <= '9') {
+                int g = *r - '0';
+                if (match->start[g] >= 0) {
+                    memcpy(out + len, text + match->start[g], match->end[g] - match->start[g]);
+                    len += match->end[g] - match->start[g];
+                }
+                continue;
+            }
+            if (*r == 't') {
+                out[len++] = '\t';
+                continue;
+            }
+        }
+        out[len++] = *r;
+    }
+    out[len] = 0;
+    if (out_len) *out_len = len;
+    return out;
+}
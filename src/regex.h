@@ -0,0 +1,30 @@
+#ifndef REGEX_H_
+#define REGEX_H_
+
+/* Regular expressions for search and replace.
+
+   A pattern is compiled into a small NFA program. A DFA is built from
+   it lazily, one state at a time, and used to reject text without a
+   match in a single linear pass. Only text that does match is run
+   through a Pike VM to find where the match and its capture groups are.
+   Neither step backtracks, so matching is linear in the text size.
+
+   Supported syntax: literals, . [abc] [^a-z] \d \w \s \D \W \S,
+   ^ $, (groups), a|b, and * + ? (with *? +? ?? being non-greedy).
+   In replacements, \0 to \9 insert the capture groups. */
+
+#define REGEX_MAX_GROUPS 10
+
+struct Regex;
+
+struct RegexMatch {
+    int start[REGEX_MAX_GROUPS]; /* -1 if the group didn't participate. */
+    int end[REGEX_MAX_GROUPS];
+};
+
+struct Regex *regex_compile(const char *pattern);
+void          regex_free(struct Regex *re);
+int           regex_find(struct Regex *re, const char *text, int len, int start, struct RegexMatch *match);
+char         *regex_expand(const char *replacement, const char *text, const struct RegexMatch *match, int *out_len);
+
+#endif /* REGEX_H_ */
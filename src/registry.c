@@ -0,0 +1,180 @@
+#include "registry.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "buffer.h"
+#include "util.h"
+
+struct RegistryTable {
+    struct Buffer **buckets;
+    unsigned size, count;
+};
+
+static struct RegistryTable tables[REGISTRY_KEYS];
+
+/* FNV-1a. */
+static unsigned hash_bytes(const void *data, int len, unsigned hash) {
+    const unsigned char *p = data;
+    int i;
+    for (i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static unsigned hash_path(const char *path) {
+    unsigned hash = 2166136261u;
+    for (; *path; path++) {
+#ifdef _WIN32
+        unsigned char c = tolower((unsigned char)*path);
+#else
+        unsigned char c = *path;
+#endif
+        hash = hash_bytes(&c, 1, hash);
+    }
+    return hash;
+}
+
+static bool path_equals(const char *a, const char *b) {
+#ifdef _WIN32
+    for (; *a && tolower((unsigned char)*a) == tolower((unsigned char)*b); a++, b++);
+    return tolower((unsigned char)*a) == tolower((unsigned char)*b);
+#else
+    return 0 == strcmp(a, b);
+#endif
+}
+
+static unsigned hash_inode(unsigned long dev, unsigned long ino) {
+    return hash_bytes(&ino, sizeof(ino), hash_bytes(&dev, sizeof(dev), 2166136261u));
+}
+
+/* Whether buf has a key of that kind. Buffers without a file only have a name. */
+static bool registry_has(struct Buffer *buf, int key) {
+    switch (key) {
+        case REGISTRY_PATH:  return strlen(buf->filename) > 0;
+        case REGISTRY_INODE: return buf->file_ino != 0;
+    }
+    return true;
+}
+
+static unsigned registry_hash(struct Buffer *buf, int key) {
+    switch (key) {
+        case REGISTRY_PATH:  return hash_path(buf->filename);
+        case REGISTRY_INODE: return hash_inode(buf->file_dev, buf->file_ino);
+    }
+    return hash_bytes(buf->name, strlen(buf->name), 2166136261u);
+}
+
+static void table_link(struct RegistryTable *t, struct Buffer *buf, int key) {
+    struct Buffer **b = &t->buckets[buf->registry_hash[key] & (t->size-1)];
+    /* At the end, so the first of several buffers with a name stays first. */
+    while (*b) b = &(*b)->registry_next[key];
+    buf->registry_next[key] = NULL;
+    *b = buf;
+}
+
+static void table_grow(struct RegistryTable *t, int key) {
+    struct Buffer **old = t->buckets, *buf, *next;
+    unsigned old_size = t->size, i;
+
+    t->size = t->size ? t->size*2 : REGISTRY_MIN_BUCKETS;
+    t->buckets = alloc(t->size, sizeof(struct Buffer *));
+    for (i = 0; i < old_size; i++) {
+        for (buf = old[i]; buf; buf = next) {
+            next = buf->registry_next[key];
+            table_link(t, buf, key);
+        }
+    }
+    dealloc(old);
+}
+
+void registry_add(struct Buffer *buf) {
+    int key;
+
+    if (buf->registry_keys) return;
+    for (key = 0; key < REGISTRY_KEYS; key++) {
+        struct RegistryTable *t = &tables[key];
+        if (!registry_has(buf, key)) continue;
+        if (t->count >= t->size) table_grow(t, key);
+        buf->registry_hash[key] = registry_hash(buf, key);
+        table_link(t, buf, key);
+        t->count++;
+        buf->registry_keys |= 1 << key;
+    }
+}
+
+void registry_remove(struct Buffer *buf) {
+    int key;
+
+    /* By the keys it was added with, which may not be the ones it has now. */
+    for (key = 0; key < REGISTRY_KEYS; key++) {
+        struct RegistryTable *t = &tables[key];
+        struct Buffer **b;
+        if (!(buf->registry_keys & (1 << key))) continue;
+
+        b = &t->buckets[buf->registry_hash[key] & (t->size-1)];
+        while (*b != buf) b = &(*b)->registry_next[key];
+        *b = buf->registry_next[key];
+        if (--t->count == 0) {
+            dealloc(t->buckets);
+            t->buckets = NULL;
+            t->size = 0;
+        }
+    }
+    buf->registry_keys = 0;
+}
+
+/* Called when buf's name or file changes, or its file is first written. */
+void registry_update(struct Buffer *buf) {
+    struct stat st;
+
+    registry_remove(buf);
+    buf->file_dev = buf->file_ino = 0;
+    if (strlen(buf->filename) && 0 == stat(buf->filename, &st)) {
+        buf->file_dev = st.st_dev;
+        buf->file_ino = st.st_ino;
+    }
+    registry_add(buf);
+}
+
+struct Buffer *registry_find_name(const char *name) {
+    struct RegistryTable *t = &tables[REGISTRY_NAME];
+    unsigned hash = hash_bytes(name, strlen(name), 2166136261u);
+    struct Buffer *buf;
+
+    if (!t->size) return NULL;
+    for (buf = t->buckets[hash & (t->size-1)]; buf; buf = buf->registry_next[REGISTRY_NAME]) {
+        if (buf->registry_hash[REGISTRY_NAME] == hash && 0 == strcmp(buf->name, name)) return buf;
+    }
+    return NULL;
+}
+
+/* The buffer holding the file at absolute_path, by its inode if it exists
+ * and otherwise by the path. */
+struct Buffer *registry_find_file(const char *absolute_path) {
+    struct RegistryTable *t;
+    struct Buffer *buf;
+    struct stat st;
+    unsigned hash;
+
+    t = &tables[REGISTRY_INODE];
+    if (t->size && 0 == stat(absolute_path, &st) && st.st_ino) {
+        unsigned long dev = st.st_dev, ino = st.st_ino;
+        hash = hash_inode(dev, ino);
+        for (buf = t->buckets[hash & (t->size-1)]; buf; buf = buf->registry_next[REGISTRY_INODE]) {
+            if (buf->file_dev == dev && buf->file_ino == ino) return buf;
+        }
+    }
+
+    t = &tables[REGISTRY_PATH];
+    if (!t->size) return NULL;
+    hash = hash_path(absolute_path);
+    for (buf = t->buckets[hash & (t->size-1)]; buf; buf = buf->registry_next[REGISTRY_PATH]) {
+        if (buf->registry_hash[REGISTRY_PATH] == hash && path_equals(buf->filename, absolute_path)) return buf;
+    }
+    return NULL;
+}
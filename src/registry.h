@@ -0,0 +1,29 @@
+#ifndef REGISTRY_H_
+#define REGISTRY_H_
+
+/* Finds buffers by name and by file without walking the buffer list. Every
+   buffer is in three hash tables: by name, by absolute path, and by the
+   file's device and inode, so the same file opened through a symlink or
+   spelled differently is still found. Windows has no inodes, so there the
+   path is compared without case instead. Chains go through the buffers
+   themselves, and each table doubles when it has more buffers than
+   buckets. */
+
+#define REGISTRY_MIN_BUCKETS 64
+
+enum {
+    REGISTRY_NAME,
+    REGISTRY_PATH,
+    REGISTRY_INODE,
+    REGISTRY_KEYS
+};
+
+struct Buffer;
+
+void           registry_add(struct Buffer *buf);
+void           registry_remove(struct Buffer *buf);
+void           registry_update(struct Buffer *buf);
+struct Buffer *registry_find_name(const char *name);
+struct Buffer *registry_find_file(const char *absolute_path);
+
+#endif /* REGISTRY_H_ */
@@ -1,56 +1,149 @@
 #include "replace.h"
 
 #include <string.h>
+#include <stdlib.h>
 
 #include "util.h"
+#include "trace.h"
 #include "globals.h"
+#include "search.h"
 
 char find[1024] = {0};
 char replace[1024] = {0};
 
+/* Replaces the match after point, or every match after point if all is set.
+ * Each line with matches is rebuilt in one pass and swapped in, so it's only
+ * re-rendered once. Matches are searched for in the original text, so a
+ * replacement is never matched again. Returns the amount replaced. */
 int buffer_replace_matching(struct Buffer *buf, char *find, char *replace, bool all) {
     struct Line *line;
 
     struct Point *point = &buf->views[buf->curview].point;
+    struct ScrollBar *scroll = &buf->views[buf->curview].scroll;
     
-    unsigned find_len = strlen(find);
-    unsigned replace_len = strlen(replace);
+    int find_len = strlen(find);
+    int replace_len = strlen(replace);
+    struct SearchPattern pat;
     
     int amt = 0;
+    int cap = 256, len;
+    char *out;
     
     if (!find_len) return 0;
+    if (!search_compile(&pat, find)) return 0;
+
+    trace_begin("replace_matching");
+    out = alloc(cap, sizeof(char));
 
     for (line = point->line; line; line = line->next) {
-        int start = 0;
+        int start = 0, copied = 0, line_amt = 0, last = 0;
+        int match;
+
         if (line == point->line) {
             start = point->pos+1;
             if (start >= line->len) continue;
         }
 
-        while (start < line->len) {
-            char *match = stristr(line->str + start, find);
-            if (match) {
-                point->line = line;
-                point->pos = match - line->str;
-                start = point->pos+1;
-                
-                line_delete_chars_range(line, point->pos, point->pos + find_len);
-                line_type_string(line, point->pos, replace);
-                    
-                highlight_set(&line->hls[line->hl_count], line, (SDL_Color){0, 64, 127, 255}, point->pos, replace_len, true);
-    
-                int pos = point->line->y*SPACING + point->line->y*font_h;
-                if (pos < -font_h-buf->views[buf->curview].scroll.y || pos > window_height-buf->views[buf->curview].scroll.y-font_h*2) {
-                    buf->views[buf->curview].scroll.target_y = -font_h+(window_height/2 - font_h*2)-(SPACING*point->line->y + point->line->y * font_h);
-                }
-                
-                amt++;
-                if (!all) return 1;
-            } else {
-                start++;
-            }
+        len = 0;
+        while ((match = search_find(&pat, line->str, line->len, start)) >= 0) {
+            int keep = match - copied;
+
+            while (len + keep + replace_len + 1 > cap) cap *= 2;
+            out = reallocate(out, cap);
+
+            memcpy(out + len, line->str + copied, keep);
+            len += keep;
+            highlight_add(line, len, replace_len, (SDL_Color){0, 64, 127, 255}, true, -1);
+            memcpy(out + len, replace, replace_len);
+            last = len;
+            len += replace_len;
+
+            copied = start = match + find_len;
+            line_amt++;
+            if (!all) break;
         }
+        if (!line_amt) continue;
+
+        while (len + (line->len - copied) + 1 > cap) cap *= 2;
+        out = reallocate(out, cap);
+        memcpy(out + len, line->str + copied, line->len - copied);
+        len += line->len - copied;
+
+        line_set_string(line, out, len);
+        point->line = line;
+        point->pos = last;
+        amt += line_amt;
+        if (!all) break;
     }
+    dealloc(out);
+
+    if (amt) {
+        int pos = line_row(point->line, point->pos)*SPACING + line_row(point->line, point->pos)*font_h;
+        if (pos < -font_h-scroll->y || pos > window_height-scroll->y-font_h*2) {
+            scroll->target_y = -font_h+(window_height/2 - font_h*2)-(SPACING*line_row(point->line, point->pos) + line_row(point->line, point->pos) * font_h);
+        }
+    }
+    trace_end();
     return amt;
 }
 
+
+/* Replaces every match after point. Since later matches (and anchors) depend
+ * on the original text, each line is rebuilt from its matches in one pass and
+ * swapped in, rather than edited in place. Returns the amount replaced. */
+int buffer_regex_replace_matching(struct Buffer *buf, struct Regex *re, char *replace) {
+    struct Line *line;
+    struct Point *point = &buf->views[buf->curview].point;
+    int amt = 0;
+
+    int cap = 256, len;
+    char *out = alloc(cap, sizeof(char));
+
+    trace_begin("regex_replace_matching");
+
+    for (line = point->line; line; line = line->next) {
+        struct RegexMatch match;
+        int start = 0, copied = 0, line_amt = 0;
+
+        if (line == point->line) {
+            start = point->pos+1;
+            if (start > line->len) continue;
+        }
+
+        len = 0;
+        while (start <= line->len && regex_find(re, line->str, line->len, start, &match)) {
+            int expanded_len;
+            char *expanded = regex_expand(replace, line->str, &match, &expanded_len);
+            int keep = match.start[0] - copied;
+
+            while (len + keep + expanded_len + 1 > cap) cap *= 2;
+            out = reallocate(out, cap);
+
+            memcpy(out + len, line->str + copied, keep);
+            len += keep;
+            highlight_add(line, len, expanded_len, (SDL_Color){0, 64, 127, 255}, true, -1);
+            memcpy(out + len, expanded, expanded_len);
+            len += expanded_len;
+            dealloc(expanded);
+
+            copied = match.end[0];
+            /* Step over empty matches so we don't find them again. */
+            start = match.end[0] > match.start[0] ? match.end[0] : match.end[0]+1;
+            line_amt++;
+        }
+        if (!line_amt) continue;
+
+        while (len + (line->len - copied) + 1 > cap) cap *= 2;
+        out = reallocate(out, cap);
+        memcpy(out + len, line->str + copied, line->len - copied);
+        len += line->len - copied;
+
+        line_set_string(line, out, len);
+        amt += line_amt;
+    }
+
+    dealloc(out);
+    buffer_limit_point(buf);
+    trace_end();
+    return amt;
+}
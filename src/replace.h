@@ -2,10 +2,12 @@
 #define REPLACE_H_
 
 #include "buffer.h"
+#include "regex.h"
 
 extern char find[1024];
 extern char replace[1024];
 
 int buffer_replace_matching(struct Buffer *buf, char *find, char *replace, bool all);
+int buffer_regex_replace_matching(struct Buffer *buf, struct Regex *re, char *replace);
 
 #endif /* REPLACE_H_ */
@@ -0,0 +1,160 @@
+#include "search.h"
+
+#include <string.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SEARCH_HAVE_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Patterns at least this long skip far enough with Horspool that
+   the vectorized first/last byte filter stops paying for itself. */
+#define SEARCH_SIMD_MAX_LEN 16
+
+static unsigned char lower[256];
+static bool tables_ready = false;
+static int simd_level = 0; /* 0 = scalar, 1 = SSE2, 2 = AVX2 */
+
+/* ASCII only, so that the scalar and vector paths always agree. */
+static void search_init_tables() {
+    int i;
+    for (i = 0; i < 256; i++) {
+        lower[i] = (i >= 'A' && i <= 'Z') ? i + ('a'-'A') : i;
+    }
+#ifdef __SSE2__
+    simd_level = 1;
+#endif
+#ifdef SEARCH_HAVE_AVX2
+    if (SDL_HasAVX2()) simd_level = 2;
+#endif
+    tables_ready = true;
+}
+
+int search_compile(struct SearchPattern *pat, const char *str) {
+    int i, len = strlen(str);
+
+    if (!tables_ready) search_init_tables();
+
+    memset(pat, 0, sizeof(*pat));
+    if (len >= SEARCH_MAX_LEN) return 0;
+
+    pat->len = len;
+    for (i = 0; i < len; i++) {
+        pat->str[i] = lower[(unsigned char)str[i]];
+    }
+
+    for (i = 0; i < 256; i++) {
+        pat->shift[i] = len;
+    }
+    for (i = 0; i < len-1; i++) {
+        pat->shift[(unsigned char)pat->str[i]] = len-1-i;
+    }
+    return 1;
+}
+
+static bool matches_at(const struct SearchPattern *pat, const unsigned char *t) {
+    int i;
+    for (i = 0; i < pat->len; i++) {
+        if (lower[t[i]] != (unsigned char)pat->str[i]) return false;
+    }
+    return true;
+}
+
+#ifdef __SSE2__
+static __m128i lower_16(__m128i v) {
+    __m128i is_upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A'-1)),
+                                     _mm_cmplt_epi8(v, _mm_set1_epi8('Z'+1)));
+    return _mm_add_epi8(v, _mm_and_si128(is_upper, _mm_set1_epi8('a'-'A')));
+}
+
+/* Compares the first and last byte of the pattern against 16 positions
+   at a time, and only verifies the candidates that pass both. Leaves
+   *start where the vector loop stopped so the caller can finish the tail. */
+static int search_find_sse2(const struct SearchPattern *pat, const unsigned char *t, int text_len, int *start) {
+    const __m128i first = _mm_set1_epi8(pat->str[0]);
+    const __m128i last = _mm_set1_epi8(pat->str[pat->len-1]);
+    int i;
+
+    for (i = *start; i + pat->len-1 + 16 <= text_len; i += 16) {
+        __m128i a = lower_16(_mm_loadu_si128((const __m128i *)(t + i)));
+        __m128i b = lower_16(_mm_loadu_si128((const __m128i *)(t + i + pat->len-1)));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (matches_at(pat, t + i + bit)) return i + bit;
+            mask &= mask-1;
+        }
+    }
+    *start = i;
+    return -1;
+}
+#endif
+
+#ifdef SEARCH_HAVE_AVX2
+__attribute__((target("avx2")))
+static __m256i lower_32(__m256i v) {
+    __m256i is_upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A'-1)),
+                                        _mm256_cmpgt_epi8(_mm256_set1_epi8('Z'+1), v));
+    return _mm256_add_epi8(v, _mm256_and_si256(is_upper, _mm256_set1_epi8('a'-'A')));
+}
+
+/* Same as search_find_sse2, 32 positions at a time. */
+__attribute__((target("avx2")))
+static int search_find_avx2(const struct SearchPattern *pat, const unsigned char *t, int text_len, int *start) {
+    const __m256i first = _mm256_set1_epi8(pat->str[0]);
+    const __m256i last = _mm256_set1_epi8(pat->str[pat->len-1]);
+    int i;
+
+    for (i = *start; i + pat->len-1 + 32 <= text_len; i += 32) {
+        __m256i a = lower_32(_mm256_loadu_si256((const __m256i *)(t + i)));
+        __m256i b = lower_32(_mm256_loadu_si256((const __m256i *)(t + i + pat->len-1)));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (matches_at(pat, t + i + bit)) return i + bit;
+            mask &= mask-1;
+        }
+    }
+    *start = i;
+    return -1;
+}
+#endif
+
+/* Returns the index of the first match at or after start, or -1. */
+int search_find(const struct SearchPattern *pat, const char *text, int text_len, int start) {
+    const unsigned char *t = (const unsigned char *)text;
+    int last = pat->len-1;
+    int i = start;
+
+    if (pat->len == 0 || i < 0) return -1;
+
+    if (pat->len < SEARCH_SIMD_MAX_LEN) {
+        int match = -1;
+#ifdef SEARCH_HAVE_AVX2
+        if (simd_level == 2) match = search_find_avx2(pat, t, text_len, &i);
+#endif
+#ifdef __SSE2__
+        if (match < 0 && simd_level >= 1) match = search_find_sse2(pat, t, text_len, &i);
+#endif
+        if (match >= 0) return match;
+    }
+
+    /* Horspool: compare the last byte of the window first, and skip
+       ahead by how far that byte is from the end of the pattern. */
+    while (i + last < text_len) {
+        unsigned char c = lower[t[i+last]];
+        if (c == (unsigned char)pat->str[last] && matches_at(pat, t + i)) return i;
+        i += pat->shift[c];
+    }
+    return -1;
+}
+
+/* Does the pattern match exactly at pos? */
+int search_match_at(const struct SearchPattern *pat, const char *text, int text_len, int pos) {
+    if (pat->len == 0 || pos < 0 || pos + pat->len > text_len) return 0;
+    return matches_at(pat, (const unsigned char *)text + pos);
+}
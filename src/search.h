@@ -0,0 +1,21 @@
+#ifndef SEARCH_H_
+#define SEARCH_H_
+
+/* Case-insensitive substring search kernel used by isearch, find and
+   replace. A pattern is compiled once, then every match in a line can
+   be found in a single pass by calling search_find from the previous
+   match + 1. */
+
+#define SEARCH_MAX_LEN 1024
+
+struct SearchPattern {
+    char str[SEARCH_MAX_LEN]; /* Lowercased copy of the pattern. */
+    int len;
+    int shift[256];           /* Horspool bad-character shifts, indexed by lowercased byte. */
+};
+
+int search_compile(struct SearchPattern *pat, const char *str);
+int search_find(const struct SearchPattern *pat, const char *text, int text_len, int start);
+int search_match_at(const struct SearchPattern *pat, const char *text, int text_len, int pos);
+
+#endif /* SEARCH_H_ */
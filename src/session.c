@@ -0,0 +1,143 @@
+#include "session.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "minibuffer.h"
+#include "panel.h"
+#include "util.h"
+
+/* Buffers worth keeping: the ones holding a file. */
+static bool session_keeps(struct Buffer *buf) {
+    return buf && buf != minibuf && strlen(buf->filename) && !buf->read_only;
+}
+
+/* Index of buf among the kept buffers, or -1. */
+static int session_index(struct Buffer *buf) {
+    struct Buffer *b;
+    int i = 0;
+    if (!session_keeps(buf)) return -1;
+    for (b = headbuf; b != buf; b = b->next) {
+        if (session_keeps(b)) i++;
+    }
+    return i;
+}
+
+/* The file is one line per buffer, then the panels:
+ *
+ *   buffer <curview> (<y> <pos> <scroll x> <scroll y>) per view <path>
+ *   panels <left> <right> <current>
+ *
+ * The path goes last so it can have spaces in it. */
+void session_save() {
+    FILE *fp = fopen(SESSION_FILE, "w");
+    struct Buffer *buf, *current = curbuf == minibuf ? prevbuf : curbuf;
+    int i;
+
+    if (!fp) return;
+
+    for (buf = headbuf; buf; buf = buf->next) {
+        if (!session_keeps(buf)) continue;
+        fprintf(fp, "buffer %d", buf->curview);
+        for (i = 0; i < buf->view_count; i++) {
+            struct SessionView v;
+            if (buf->session) {
+                v = buf->session[i];
+            } else {
+                v.y = buf->views[i].point.line->y;
+                v.pos = buf->views[i].point.pos;
+                v.scroll_x = buf->views[i].scroll.target_x;
+                v.scroll_y = buf->views[i].scroll.target_y;
+            }
+            fprintf(fp, " %d %d %d %d", v.y, v.pos, v.scroll_x, v.scroll_y);
+        }
+        fprintf(fp, " %s\n", buf->filename);
+    }
+    fprintf(fp, "panels %d %d %d\n", session_index(panel_left), session_index(panel_right), session_index(current));
+    fclose(fp);
+}
+
+/* Sets up headbuf, the panels and curbuf from the session file, reading
+ * only the files that are shown. False if there's no session to restore. */
+bool session_restore() {
+    FILE *fp = fopen(SESSION_FILE, "r");
+    struct Buffer *buf, *tail = NULL, *left = NULL, *right = NULL, *current = NULL;
+    char line[BUF_NAME_LEN + 128];
+    int left_index = -1, right_index = -1, current_index = -1, count = 0;
+
+    if (!fp) return false;
+
+    while (fgets(line, sizeof(line), fp)) {
+        struct SessionView views[2];
+        int curview, path_at = 0, len = strlen(line);
+
+        if (len && line[len-1] == '\n') line[--len] = 0;
+
+        if (3 == sscanf(line, "panels %d %d %d", &left_index, &right_index, &current_index)) continue;
+        if (9 != sscanf(line, "buffer %d %d %d %d %d %d %d %d %d %n", &curview,
+                         &views[0].y, &views[0].pos, &views[0].scroll_x, &views[0].scroll_y,
+                         &views[1].y, &views[1].pos, &views[1].scroll_x, &views[1].scroll_y, &path_at) || !path_at) {
+            continue;
+        }
+        if (strlen(line + path_at) >= BUF_NAME_LEN || buffer_find_file(line + path_at)) continue;
+
+        buf = buffer_allocate(line + path_at);
+        buffer_set_filename(buf, line + path_at);
+        buf->curview = curview ? 1 : 0;
+        buf->session = alloc(2, sizeof(struct SessionView));
+        memcpy(buf->session, views, sizeof(views));
+
+        if (tail) {
+            tail->next = buf;
+            buf->prev = tail;
+        } else {
+            headbuf = buf;
+        }
+        tail = buf;
+        count++;
+    }
+    fclose(fp);
+
+    if (!headbuf) return false;
+
+    for (buf = headbuf, count = 0; buf; buf = buf->next, count++) {
+        if (count == left_index)    left = buf;
+        if (count == right_index)   right = buf;
+        if (count == current_index) current = buf;
+    }
+    if (!left) {
+        left = right ? right : headbuf;
+        right = NULL;
+    }
+    panel_left = left;
+    panel_right = right;
+    curbuf = current == left || current == right ? current : left;
+
+    session_load_buffer(panel_left);
+    session_load_buffer(panel_right);
+    return true;
+}
+
+/* Reads the file of a buffer that was restored from the session, if it
+ * hasn't been yet, and puts its views back where they were. */
+void session_load_buffer(struct Buffer *buf) {
+    int i;
+
+    if (!buf || !buf->session) return;
+
+    buffer_load_file(buf, buf->filename);
+    for (i = 0; i < buf->view_count; i++) {
+        struct SessionView *v = &buf->session[i];
+        struct View *view = &buf->views[i];
+        struct Line *line = buffer_line_at(buf, v->y < 0 ? 0 : v->y < buf->line_count ? v->y : buf->line_count-1);
+        int pos = v->pos < 0 ? 0 : v->pos < line->len ? v->pos : line->len;
+
+        view->point.line = line;
+        view->point.pos = line_byte_at_col(line, line_visual_col(line, pos));
+        view->scroll.x = view->scroll.target_x = v->scroll_x;
+        view->scroll.y = view->scroll.target_y = v->scroll_y;
+    }
+    dealloc(buf->session);
+    buf->session = NULL;
+}
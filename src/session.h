@@ -0,0 +1,26 @@
+#ifndef SESSION_H_
+#define SESSION_H_
+
+#include <stdbool.h>
+
+/* Remembers the open files, the panels, and where each view was, from one
+   run to the next. The session is written on exit and read back at start,
+   but only the buffers that are shown read their files then. The rest are
+   made with just their file name, and read it the first time they're
+   shown or searched, so a long session starts as fast as a short one. */
+
+#define SESSION_FILE "ame.session"
+
+struct Buffer;
+
+/* Where a view was, kept until the buffer is loaded. */
+struct SessionView {
+    int y, pos;
+    int scroll_x, scroll_y;
+};
+
+bool session_restore();
+void session_save();
+void session_load_buffer(struct Buffer *buf);
+
+#endif /* SESSION_H_ */
@@ -0,0 +1,240 @@
+#include "syntax.h"
+
+#include <string.h>
+#include <ctype.h>
+
+#include "buffer.h"
+#include "util.h"
+
+const SDL_Color token_colors[TOKEN_COUNT] = {
+    {255, 255, 255, 255}, /* TOKEN_TEXT */
+    {237, 148,  90, 255}, /* TOKEN_KEYWORD */
+    {110, 190, 235, 255}, /* TOKEN_TYPE */
+    {152, 195, 121, 255}, /* TOKEN_STRING */
+    {209, 154, 102, 255}, /* TOKEN_NUMBER */
+    {118, 122, 140, 255}, /* TOKEN_COMMENT */
+    {198, 120, 221, 255}, /* TOKEN_PREPROC */
+    {237, 148,  90, 255}, /* TOKEN_SECTION */
+};
+
+static const char *c_extensions[] = { ".c", ".h", ".cpp", ".hpp", ".cc", ".cxx", ".hh", NULL };
+static const char *c_keywords[] = {
+    "auto", "break", "case", "const", "continue", "default", "do", "else", "enum",
+    "extern", "for", "goto", "if", "inline", "register", "restrict", "return",
+    "sizeof", "static", "struct", "switch", "typedef", "union", "volatile", "while",
+    "class", "namespace", "template", "typename", "public", "private", "protected",
+    "virtual", "new", "delete", "using", "this", "true", "false", "NULL", "nullptr", NULL
+};
+static const char *c_types[] = {
+    "char", "short", "int", "long", "float", "double", "void", "signed", "unsigned",
+    "bool", "size_t", "ssize_t", "int8_t", "int16_t", "int32_t", "int64_t", "uint8_t",
+    "uint16_t", "uint32_t", "uint64_t", "FILE", "Uint8", "Uint16", "Uint32", "Uint64",
+    "Sint32", "Sint64", NULL
+};
+
+static const char *ini_extensions[] = { ".ini", ".cfg", ".conf", ".toml", ".desktop", ".gitconfig", NULL };
+static const char *ini_keywords[] = { "true", "false", "yes", "no", "on", "off", NULL };
+
+static const char *json_extensions[] = { ".json", NULL };
+static const char *json_keywords[] = { "true", "false", "null", NULL };
+
+static const char *shell_extensions[] = { ".sh", ".bash", ".mk", "Makefile", "makefile", "GNUmakefile", NULL };
+static const char *shell_keywords[] = {
+    "if", "then", "else", "elif", "fi", "for", "in", "do", "done", "while", "until",
+    "case", "esac", "function", "return", "export", "local", "ifeq", "ifneq", "ifdef",
+    "ifndef", "endif", "include", "define", "endef", NULL
+};
+
+static const struct Syntax syntaxes[] = {
+    { "C",     c_extensions,     "//", NULL, "/*", "*/", c_keywords,     c_types, true,  false, true  },
+    { "INI",   ini_extensions,   "#",  ";",  NULL, NULL, ini_keywords,   NULL,    false, true,  false },
+    { "JSON",  json_extensions,  NULL, NULL, NULL, NULL, json_keywords,  NULL,    false, false, false },
+    { "Shell", shell_extensions, "#",  NULL, NULL, NULL, shell_keywords, NULL,    false, false, false },
+};
+
+/* Picks the syntax by extension, or by the whole file name. NULL if none. */
+const struct Syntax *syntax_for_file(const char *filename) {
+    const char *base = filename, *p;
+    int i, j;
+
+    for (p = filename; *p; p++) {
+        if (*p == '/' || *p == '\\') base = p+1;
+    }
+
+    for (i = 0; i < (int)(sizeof(syntaxes)/sizeof(*syntaxes)); i++) {
+        for (j = 0; syntaxes[i].extensions[j]; j++) {
+            const char *ext = syntaxes[i].extensions[j];
+            int base_len = strlen(base), ext_len = strlen(ext);
+            if (ext[0] != '.' && 0 == strcmp(base, ext)) return &syntaxes[i];
+            if (ext[0] == '.' && base_len > ext_len && 0 == strcmp(base + base_len - ext_len, ext)) return &syntaxes[i];
+        }
+    }
+    return NULL;
+}
+
+static bool starts_with_at(const char *str, int len, int i, const char *s) {
+    int n;
+    if (!s) return false;
+    n = strlen(s);
+    return i + n <= len && 0 == memcmp(str + i, s, n);
+}
+
+static bool in_list(const char **list, const char *str, int len) {
+    int i;
+    if (!list) return false;
+    for (i = 0; list[i]; i++) {
+        if ((int)strlen(list[i]) == len && 0 == memcmp(list[i], str, len)) return true;
+    }
+    return false;
+}
+
+static bool is_ident(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static void mark(unsigned char *tokens, int from, int to, int token) {
+    if (tokens) memset(tokens + from, token, to - from);
+}
+
+/* Lexes a line starting in state, and returns the state it ends in. If
+ * tokens isn't NULL it gets the token of every byte. */
+int syntax_lex(const struct Syntax *syntax, const char *str, int len, int state, unsigned char *tokens) {
+    int i = 0, start;
+
+    mark(tokens, 0, len, TOKEN_TEXT);
+
+    if (state == SYNTAX_IN_COMMENT) {
+        for (; i < len && !starts_with_at(str, len, i, syntax->block_end); i++);
+        if (i == len) {
+            mark(tokens, 0, len, TOKEN_COMMENT);
+            return SYNTAX_IN_COMMENT;
+        }
+        i += strlen(syntax->block_end);
+        mark(tokens, 0, i, TOKEN_COMMENT);
+    } else if (state == SYNTAX_IN_STRING) {
+        for (; i < len && str[i] != '"'; i++) {
+            if (str[i] == '\\') i++;
+        }
+        if (i >= len) {
+            mark(tokens, 0, len, TOKEN_STRING);
+            return len && str[len-1] == '\\' ? SYNTAX_IN_STRING : SYNTAX_NORMAL;
+        }
+        mark(tokens, 0, ++i, TOKEN_STRING);
+    } else {
+        for (start = 0; start < len && isspace((unsigned char)str[start]); start++);
+        if (syntax->preprocessor && start < len && str[start] == '#') {
+            for (i = start+1; i < len && isspace((unsigned char)str[i]); i++);
+            for (; i < len && is_ident(str[i]); i++);
+            mark(tokens, start, i, TOKEN_PREPROC);
+
+            /* #include <file> */
+            for (; i < len && isspace((unsigned char)str[i]); i++);
+            if (i < len && str[i] == '<') {
+                start = i;
+                for (; i < len && str[i] != '>'; i++);
+                if (i < len) i++;
+                mark(tokens, start, i, TOKEN_STRING);
+            }
+        } else if (syntax->sections && start < len && str[start] == '[') {
+            for (i = start; i < len && str[i] != ']'; i++);
+            if (i < len) i++;
+            mark(tokens, start, i, TOKEN_SECTION);
+        } else if (syntax->sections && start < len && is_ident(str[start])) {
+            int key_end;
+            for (i = start; i < len && str[i] != '=' && str[i] != ':'; i++);
+            if (i < len) {
+                for (key_end = i; key_end > start && isspace((unsigned char)str[key_end-1]); key_end--);
+                mark(tokens, start, key_end, TOKEN_TYPE);
+            } else {
+                i = start;
+            }
+        }
+    }
+
+    while (i < len) {
+        char c = str[i];
+
+        if (starts_with_at(str, len, i, syntax->line_comment) || starts_with_at(str, len, i, syntax->line_comment2)) {
+            mark(tokens, i, len, TOKEN_COMMENT);
+            return SYNTAX_NORMAL;
+        }
+        if (starts_with_at(str, len, i, syntax->block_start)) {
+            start = i;
+            for (i += strlen(syntax->block_start); i < len && !starts_with_at(str, len, i, syntax->block_end); i++);
+            if (i == len) {
+                mark(tokens, start, len, TOKEN_COMMENT);
+                return SYNTAX_IN_COMMENT;
+            }
+            i += strlen(syntax->block_end);
+            mark(tokens, start, i, TOKEN_COMMENT);
+            continue;
+        }
+        if (c == '"' || c == '\'') {
+            start = i;
+            for (i++; i < len && str[i] != c; i++) {
+                if (str[i] == '\\') i++;
+            }
+            if (i >= len) {
+                mark(tokens, start, len, TOKEN_STRING);
+                if (c == '"' && syntax->continued_strings && str[len-1] == '\\') return SYNTAX_IN_STRING;
+                return SYNTAX_NORMAL;
+            }
+            mark(tokens, start, ++i, TOKEN_STRING);
+            continue;
+        }
+        if (isdigit((unsigned char)c)) {
+            start = i;
+            for (i++; i < len && (is_ident(str[i]) || str[i] == '.'); i++);
+            mark(tokens, start, i, TOKEN_NUMBER);
+            continue;
+        }
+        if (is_ident(c)) {
+            start = i;
+            for (; i < len && is_ident(str[i]); i++);
+            if (in_list(syntax->keywords, str + start, i - start)) {
+                mark(tokens, start, i, TOKEN_KEYWORD);
+            } else if (in_list(syntax->types, str + start, i - start)) {
+                mark(tokens, start, i, TOKEN_TYPE);
+            }
+            continue;
+        }
+        i++;
+    }
+    return SYNTAX_NORMAL;
+}
+
+/* Brings the lexer states up to date for the rows lines from first, which
+ * are the ones on screen. Starts from the first line an edit may have
+ * changed, and skips the lines whose text and starting state are the same
+ * as when they were last lexed, so after an edit this only lexes until
+ * the states converge again. Lines whose colors changed are re-rendered
+ * when they're drawn. */
+void syntax_update(struct Buffer *buf, struct Line *first, int rows) {
+    struct Line *line, *last = first;
+    int i, state;
+
+    if (!buf->syntax) return;
+
+    for (i = 1; i < rows && last->next; i++) last = last->next;
+    if (last->y < buf->syntax_valid) return;
+
+    for (line = first; line->y > buf->syntax_valid && line->prev; line = line->prev);
+
+    state = line->prev ? line->prev->syntax_end : SYNTAX_NORMAL;
+    for (;; line = line->next) {
+        if (line->syntax_dirty || line->syntax_start != state) {
+            if (line->syntax_start != state && line->main_texture) {
+                SDL_DestroyTexture(line->main_texture);
+                line->main_texture = NULL;
+            }
+            dealloc(line->tokens);
+            line->tokens = NULL;
+            line->syntax_start = state;
+            line->syntax_end = syntax_lex(buf->syntax, line->str, line->len, state, NULL);
+            line->syntax_dirty = false;
+        }
+        state = line->syntax_end;
+        if (line == last) break;
+    }
+    buf->syntax_valid = last->y+1;
+}
@@ -0,0 +1,51 @@
+#ifndef SYNTAX_H_
+#define SYNTAX_H_
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+/* Syntax highlighting. Each line remembers the lexer's state at its start
+   and end, so after an edit only the lines from the edited one on are
+   lexed again, and only until the states line up with what they were.
+   Lines past the bottom of the screen aren't lexed until they're shown. */
+
+struct Line;
+struct Buffer;
+
+/* Where a line leaves the lexer. */
+enum {
+    SYNTAX_NORMAL,
+    SYNTAX_IN_COMMENT,          /* Inside a block comment. */
+    SYNTAX_IN_STRING            /* Inside a string continued with a backslash. */
+};
+
+enum {
+    TOKEN_TEXT,
+    TOKEN_KEYWORD,
+    TOKEN_TYPE,
+    TOKEN_STRING,
+    TOKEN_NUMBER,
+    TOKEN_COMMENT,
+    TOKEN_PREPROC,
+    TOKEN_SECTION,
+    TOKEN_COUNT
+};
+
+struct Syntax {
+    const char *name;
+    const char **extensions;        /* Or whole file names, like "Makefile". */
+    const char *line_comment, *line_comment2;
+    const char *block_start, *block_end;
+    const char **keywords, **types;
+    bool preprocessor;              /* Lines starting with # are directives. */
+    bool sections;                  /* [section] headers and key = value lines. */
+    bool continued_strings;         /* A backslash at the end continues a string. */
+};
+
+extern const SDL_Color token_colors[TOKEN_COUNT];
+
+const struct Syntax *syntax_for_file(const char *filename);
+int                  syntax_lex(const struct Syntax *syntax, const char *str, int len, int state, unsigned char *tokens);
+void                 syntax_update(struct Buffer *buf, struct Line *first, int rows);
+
+#endif /* SYNTAX_H_ */
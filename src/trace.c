@@ -0,0 +1,200 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "util.h"
+
+#ifdef TRACE_EVENTS
+
+struct TraceSpan {
+    const char *name;
+    Uint64 start, end;        /* Performance counter ticks. */
+};
+
+/* Only its thread writes spans and moves head, and only the flusher
+ * reads them and moves tail, so neither has to lock. */
+struct TraceRing {
+    struct TraceSpan spans[TRACE_RING_SIZE];
+    SDL_atomic_t head, tail;  /* Spans written and read, wrapping freely. */
+
+    const char *open[TRACE_DEPTH];
+    Uint64 open_start[TRACE_DEPTH];
+    int depth;
+    int dropped;
+
+    SDL_threadID thread;
+    bool named;               /* Its thread's name has been written. */
+    struct TraceRing *next;
+};
+
+static FILE *fp = NULL;
+static bool first = true;
+static Uint64 origin, frequency;
+static SDL_threadID main_thread;
+
+static SDL_TLSID ring_key;
+static SDL_mutex *lock = NULL; /* Held while adding to or draining the rings. */
+static SDL_cond *cond = NULL;
+static struct TraceRing *rings = NULL;
+static SDL_Thread *flusher = NULL;
+static bool quitting = false;
+
+static struct TraceRing *trace_ring() {
+    struct TraceRing *ring = SDL_TLSGet(ring_key);
+    if (!ring) {
+        ring = alloc(1, sizeof(struct TraceRing));
+        ring->thread = SDL_ThreadID();
+        SDL_TLSSet(ring_key, ring, NULL);
+
+        SDL_LockMutex(lock);
+        ring->next = rings;
+        rings = ring;
+        SDL_UnlockMutex(lock);
+    }
+    return ring;
+}
+
+void _trace_begin(const char *name) {
+    struct TraceRing *ring;
+
+    if (!fp) return;
+    ring = trace_ring();
+    if (ring->depth < TRACE_DEPTH) {
+        ring->open[ring->depth] = name;
+        ring->open_start[ring->depth] = SDL_GetPerformanceCounter();
+    }
+    ring->depth++;
+}
+
+void _trace_end() {
+    struct TraceRing *ring;
+    struct TraceSpan *span;
+    unsigned head;
+
+    if (!fp) return;
+    ring = trace_ring();
+    if (ring->depth == 0) return;
+    if (--ring->depth >= TRACE_DEPTH) return;
+
+    head = SDL_AtomicGet(&ring->head);
+    if (head - (unsigned)SDL_AtomicGet(&ring->tail) >= TRACE_RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+    span = &ring->spans[head & (TRACE_RING_SIZE-1)];
+    span->name = ring->open[ring->depth];
+    span->start = ring->open_start[ring->depth];
+    span->end = SDL_GetPerformanceCounter();
+    SDL_AtomicSet(&ring->head, head+1); /* Hands the span to the flusher. */
+}
+
+static double trace_us(Uint64 ticks) {
+    return (double)(ticks - origin) * 1000000.0 / (double)frequency;
+}
+
+static void trace_write(const char *event) {
+    fputs(first ? "" : ",\n", fp);
+    fputs(event, fp);
+    first = false;
+}
+
+/* Writes out every span waiting in the rings. */
+static void trace_flush() {
+    struct TraceRing *ring;
+    char event[256];
+
+    SDL_LockMutex(lock);
+    for (ring = rings; ring; ring = ring->next) {
+        unsigned tail = SDL_AtomicGet(&ring->tail), head = SDL_AtomicGet(&ring->head);
+
+        if (!ring->named) {
+            sprintf(event, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"%s\"}}",
+                    (unsigned long)ring->thread, ring->thread == main_thread ? "main" : "worker");
+            trace_write(event);
+            ring->named = true;
+        }
+        for (; tail != head; tail++) {
+            struct TraceSpan *span = &ring->spans[tail & (TRACE_RING_SIZE-1)];
+            sprintf(event, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f}",
+                    span->name, (unsigned long)ring->thread,
+                    trace_us(span->start), trace_us(span->end) - trace_us(span->start));
+            trace_write(event);
+        }
+        SDL_AtomicSet(&ring->tail, tail);
+    }
+    fflush(fp);
+    SDL_UnlockMutex(lock);
+}
+
+static int trace_flusher(void *unused) {
+    (void)unused;
+    SDL_LockMutex(lock);
+    while (!quitting) {
+        SDL_CondWaitTimeout(cond, lock, TRACE_FLUSH_MS);
+        SDL_UnlockMutex(lock);
+        trace_flush();
+        SDL_LockMutex(lock);
+    }
+    SDL_UnlockMutex(lock);
+    return 0;
+}
+
+void trace_init() {
+    fp = fopen(TRACE_FILE, "w");
+    if (!fp) {
+        fprintf(stderr, "Couldn't open %s, not tracing.\n", TRACE_FILE);
+        return;
+    }
+    fputs("[\n", fp);
+
+    origin = SDL_GetPerformanceCounter();
+    frequency = SDL_GetPerformanceFrequency();
+    main_thread = SDL_ThreadID();
+
+    ring_key = SDL_TLSCreate();
+    lock = SDL_CreateMutex();
+    cond = SDL_CreateCond();
+    flusher = SDL_CreateThread(trace_flusher, "ame tracer", NULL);
+}
+
+/* After jobs_quit, so no worker is still in a span. */
+void trace_quit() {
+    struct TraceRing *ring;
+    char event[256];
+    Uint64 now = SDL_GetPerformanceCounter();
+
+    if (!fp) return;
+
+    SDL_LockMutex(lock);
+    quitting = true;
+    SDL_CondSignal(cond);
+    SDL_UnlockMutex(lock);
+    SDL_WaitThread(flusher, NULL);
+
+    trace_flush();
+    for (ring = rings; ring; ring = ring->next) {
+        if (!ring->dropped) continue;
+        sprintf(event, "{\"name\":\"dropped spans\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"args\":{\"count\":%d}}",
+                (unsigned long)ring->thread, trace_us(now), ring->dropped);
+        trace_write(event);
+    }
+    fputs("\n]\n", fp);
+    fclose(fp);
+    fp = NULL;
+
+    while (rings) {
+        ring = rings->next;
+        dealloc(rings);
+        rings = ring;
+    }
+    SDL_DestroyCond(cond);
+    SDL_DestroyMutex(lock);
+}
+
+#else
+
+void trace_init() {}
+void trace_quit() {}
+
+#endif /* TRACE_EVENTS */
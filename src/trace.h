@@ -0,0 +1,34 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+/* Building with -DTRACE_EVENTS times spans around event handling,
+   drawing, rendering lines, searching, loading and saving, and writes
+   them to TRACE_FILE as Chrome trace events, to be opened in
+   chrome://tracing or ui.perfetto.dev. Each thread puts its spans in a
+   ring of its own without locking, and a thread of the tracer's drains
+   the rings into the file every TRACE_FLUSH_MS. Spans ending while their
+   ring is full are dropped, and the count is written at the end.
+   Without the flag trace_begin and trace_end compile to nothing. */
+
+#include <SDL2/SDL.h>
+
+#define TRACE_FILE      "ame.trace.json"
+#define TRACE_RING_SIZE 16384  /* Spans per thread, a power of two. */
+#define TRACE_DEPTH     32     /* Spans nested deeper aren't recorded. */
+#define TRACE_FLUSH_MS  100
+
+/* Spans nest, and name must be a string literal. */
+#ifdef TRACE_EVENTS
+#define trace_begin(name) (_trace_begin(name))
+#define trace_end() (_trace_end())
+#else
+#define trace_begin(name) ((void)0)
+#define trace_end() ((void)0)
+#endif
+
+void trace_init();
+void trace_quit();
+void _trace_begin(const char *name);
+void _trace_end();
+
+#endif /* TRACE_H_ */
@@ -8,6 +8,10 @@
 #include <ctype.h>
 #include <sys/stat.h>
 
+#ifdef ALLOC_PROFILE
+#include <SDL2/SDL.h>
+#endif
+
 int sign(int n) {
     if (n < 0) {
         return -1;
@@ -25,25 +29,173 @@ float damp(float a, float b, float smooth, float dt) {
     return lerp(a, b, 1-pow(smooth, dt/1000.));
 }
 
-/*static int num_allocs = 0;*/
+#ifdef ALLOC_PROFILE
+
+#define ALLOC_SITES 1024      /* Power of two, a good few times the call sites there are. */
+
+struct AllocSite {
+    const char *file;         /* NULL while the slot is free. */
+    int line;
+    unsigned long calls;      /* Allocations and reallocations made here. */
+    size_t bytes;             /* Asked for by all of them. */
+    size_t live, peak;        /* Held by blocks last (re)allocated here. */
+};
+
+/* In front of every block, so freeing it knows its size and site. */
+union AllocHeader {
+    struct {
+        size_t size;
+        int site;
+    } h;
+    long double align;
+};
+
+static struct AllocSite sites[ALLOC_SITES];
+static int site_count = 0;
+static SDL_SpinLock sites_lock = 0; /* Workers allocate too. */
+
+/* Slot 0 takes whatever comes in once the table is three-quarters full. */
+static int alloc_site(const char *file, int line) {
+    unsigned long hash = 2166136261UL;
+    const char *c;
+    int i;
+
+    for (c = file; *c; c++) hash = (hash ^ (unsigned char)*c) * 16777619UL;
+    hash = (hash ^ (unsigned long)line) * 16777619UL;
+
+    for (i = hash & (ALLOC_SITES-1); ; i = (i+1) & (ALLOC_SITES-1)) {
+        if (i == 0) continue;
+        if (!sites[i].file) break;
+        if (sites[i].line == line && strcmp(sites[i].file, file) == 0) return i;
+    }
+    if (site_count >= ALLOC_SITES*3/4) {
+        sites[0].file = "(other)";
+        return 0;
+    }
+    sites[i].file = file;
+    sites[i].line = line;
+    site_count++;
+    return i;
+}
+
+static void *alloc_track(union AllocHeader *hdr, size_t size, const char *file, int line) {
+    struct AllocSite *site;
+
+    SDL_AtomicLock(&sites_lock);
+    hdr->h.size = size;
+    hdr->h.site = alloc_site(file, line);
+    site = &sites[hdr->h.site];
+    site->calls++;
+    site->bytes += size;
+    site->live += size;
+    if (site->live > site->peak) site->peak = site->live;
+    SDL_AtomicUnlock(&sites_lock);
+    return hdr+1;
+}
+
+static void alloc_untrack(union AllocHeader *hdr) {
+    SDL_AtomicLock(&sites_lock);
+    sites[hdr->h.site].live -= hdr->h.size;
+    SDL_AtomicUnlock(&sites_lock);
+}
+
+static int compare_sites(const void *a, const void *b) {
+    const struct AllocSite *x = a, *y = b;
+    if (x->bytes != y->bytes) return x->bytes < y->bytes ? 1 : -1;
+    return x->calls < y->calls ? 1 : x->calls > y->calls ? -1 : 0;
+}
+
+/* Writes every site's calls, bytes, live and peak bytes, the most bytes
+ * first. Live bytes left at exit are leaks. Returns 0 if the file can't
+ * be written. */
+int alloc_report(const char *path) {
+    static struct AllocSite report[ALLOC_SITES];
+    int i, count = 0;
+    unsigned long calls = 0;
+    double bytes = 0, live = 0;
+    FILE *fp = fopen(path, "w");
+
+    if (!fp) return 0;
+
+    SDL_AtomicLock(&sites_lock);
+    for (i = 0; i < ALLOC_SITES; i++) {
+        if (sites[i].file) report[count++] = sites[i];
+    }
+    SDL_AtomicUnlock(&sites_lock);
+
+    qsort(report, count, sizeof(struct AllocSite), compare_sites);
+
+    for (i = 0; i < count; i++) {
+        calls += report[i].calls;
+        bytes += report[i].bytes;
+        live += report[i].live;
+    }
+    fprintf(fp, "%d sites, %lu calls, %.0f bytes, %.0f live\n\n", count, calls, bytes, live);
+    fprintf(fp, "%10s %14s %12s %12s  %s\n", "calls", "bytes", "live", "peak", "site");
+    for (i = 0; i < count; i++) {
+        fprintf(fp, "%10lu %14.0f %12.0f %12.0f  %s:%d\n",
+                report[i].calls, (double)report[i].bytes,
+                (double)report[i].live, (double)report[i].peak,
+                report[i].file, report[i].line);
+    }
+    fclose(fp);
+    return 1;
+}
+
+#else
+
+int alloc_report(const char *path) {
+    (void)path;
+    return 0;
+}
+
+#endif /* ALLOC_PROFILE */
+
 void *_alloc(size_t num, size_t size, char *file, int line) {
+#ifdef ALLOC_PROFILE
+    void *ptr = calloc(1, sizeof(union AllocHeader) + num*size);
+#else
     void *ptr = calloc(num, size);
+#endif
     if (!ptr) {
         fprintf(stderr, "Memory allocation error in file %s and line %d!\nAborting...\n", file, line);
         exit(1);
     }
-    /*num_allocs++;*/
+#ifdef ALLOC_PROFILE
+    ptr = alloc_track(ptr, num*size, file, line);
+#endif
+    return ptr;
+}
+
+/* realloc for blocks from alloc, aborting like it when out of memory. */
+void *_reallocate(void *ptr, size_t size, char *file, int line) {
+#ifdef ALLOC_PROFILE
+    union AllocHeader *hdr = ptr ? (union AllocHeader *)ptr - 1 : NULL;
+    if (hdr) alloc_untrack(hdr);
+    ptr = realloc(hdr, sizeof(union AllocHeader) + size);
+#else
+    ptr = realloc(ptr, size);
+#endif
+    if (!ptr && size) {
+        fprintf(stderr, "Memory allocation error in file %s and line %d!\nAborting...\n", file, line);
+        exit(1);
+    }
+#ifdef ALLOC_PROFILE
+    ptr = alloc_track(ptr, size, file, line);
+#endif
     return ptr;
 }
 
 void _dealloc(void *ptr) {
+#ifdef ALLOC_PROFILE
+    if (ptr) {
+        ptr = (union AllocHeader *)ptr - 1;
+        alloc_untrack(ptr);
+    }
+#endif
     free(ptr);
 }
 
-/*int get_leaked_allocations() {
-    return num_allocs;
-}*/
-
 void remove_directory(char *dst, char *src) {
     int start = strlen(src)-1;
     while (src[start] != '\\' && src[start] != '/') {
@@ -76,39 +228,26 @@ void get_cwd(char *dst) {
     dst[len+1] = 0;
 }
 
-int string_begins_with(const char *a, const char *b) {
-   if(strncmp(a, b, strlen(b)) == 0) return 1;
-   return 0;
+int is_absolute_path(const char *path) {
+    if (path[0] == '/' || path[0] == '\\') return 1;
+    if (isalpha((unsigned char)path[0]) && path[1] == ':') return 1; /* Drive letter */
+    return 0;
 }
 
-/* Taken from https://stackoverflow.com/a/27304609 */
-char* stristr(const char* str1, const char* str2) {
-    const char* p1 = str1;
-    const char* p2 = str2;
-    const char* r = *p2 == 0 ? str1 : 0;
-
-    while (*p1 != 0 && *p2 != 0) {
-        if (tolower((unsigned char)*p1) == tolower((unsigned char)*p2)) {
-            if (r == 0) {
-                r = p1;
-            }
-            p2++;
-        } else {
-            p2 = str2;
-            if (r != 0) {
-                p1 = r+1;
-            }
-
-            if (tolower((unsigned char)*p1) == tolower((unsigned char)*p2)) {
-                r = p1;
-                p2++;
-            } else {
-                r = 0;
-            }
-        }
-        p1++;
+/* Resolve path against dir (which ends in a slash) without touching the
+ * process' working directory. Absolute paths are copied as-is. */
+void resolve_path(char *dst, const char *dir, const char *path) {
+    if (is_absolute_path(path) || !*dir) {
+        strcpy(dst, path);
+        return;
     }
-    return *p2 == 0 ? (char*)r : 0;
+    strcpy(dst, dir);
+    strcat(dst, path);
+}
+
+int string_begins_with(const char *a, const char *b) {
+   if(strncmp(a, b, strlen(b)) == 0) return 1;
+   return 0;
 }
 
 int is_directory(const char *path) {
@@ -142,3 +281,40 @@ int determine_tabs_indent_method(const char *str) {
     }
     return indent > 0;
 }
+
+/* Bytes in the character starting at str[pos]. ASCII, and bytes that
+ * don't start a valid UTF-8 sequence, count as one character each. */
+int utf8_char_len(const char *str, int len, int pos) {
+    const unsigned char *s = (const unsigned char *)str + pos;
+    int n, i, left = len - pos;
+    unsigned char lo = 0x80, hi = 0xBF;
+
+    if (s[0] < 0xC2 || s[0] > 0xF4) return 1;
+    n = s[0] < 0xE0 ? 2 : s[0] < 0xF0 ? 3 : 4;
+    if (n > left) return 1;
+
+    /* Overlong forms, surrogates and past U+10FFFF. */
+    if (s[0] == 0xE0) lo = 0xA0;
+    if (s[0] == 0xED) hi = 0x9F;
+    if (s[0] == 0xF0) lo = 0x90;
+    if (s[0] == 0xF4) hi = 0x8F;
+    if (s[1] < lo || s[1] > hi) return 1;
+    for (i = 2; i < n; i++) {
+        if ((s[i] & 0xC0) != 0x80) return 1;
+    }
+    return n;
+}
+
+/* Start of the character after the one at pos. */
+int utf8_next(const char *str, int len, int pos) {
+    if (pos >= len) return len;
+    return pos + utf8_char_len(str, len, pos);
+}
+
+/* Start of the character before pos, which is the start of one. */
+int utf8_prev(const char *str, int len, int pos) {
+    int i = pos-1;
+    if (pos <= 0) return 0;
+    while (i > 0 && pos - i < 4 && ((unsigned char)str[i] & 0xC0) == 0x80) i--;
+    return i + utf8_char_len(str, len, i) == pos ? i : pos-1;
+}
@@ -3,8 +3,14 @@
 
 #include <stddef.h>
 
+/* Building with -DALLOC_PROFILE counts what every call site allocates,
+   reallocates and still holds. The report goes to ALLOC_REPORT_FILE on
+   exit and on Alt+M, busiest sites first. */
+#define ALLOC_REPORT_FILE "ame.allocs"
+
 #define alloc(num, size) (_alloc(num, size, __FILE__, __LINE__))
-#define dealloc(ptr) (free(ptr))
+#define reallocate(ptr, size) (_reallocate(ptr, size, __FILE__, __LINE__))
+#define dealloc(ptr) (_dealloc(ptr))
 #define is_ctrl() (SDL_GetModState() & KMOD_LCTRL || SDL_GetModState() & KMOD_RCTRL)
 #define is_shift() (SDL_GetModState() & KMOD_LSHIFT || SDL_GetModState() & KMOD_RSHIFT)
 #define is_alt() (SDL_GetModState() & KMOD_LALT || SDL_GetModState() & KMOD_RALT)
@@ -14,14 +20,21 @@ float lerp(float a, float b, float n);
 float damp(float a, float b, float smooth, float dt); /* Frame-rate indepdendent damping. */
 
 void *_alloc(size_t num, size_t size, char *file, int line);
+void *_reallocate(void *ptr, size_t size, char *file, int line);
 void _dealloc(void *ptr);
+int alloc_report(const char *path);
 
 void remove_directory(char *dst, char *src);
 void isolate_directory(char *dst, char *src);
 void get_cwd(char *dst);
+int is_absolute_path(const char *path);
+void resolve_path(char *dst, const char *dir, const char *path);
 int string_begins_with(const char *a, const char *b);
 int is_directory(const char *path);
-char *stristr(const char *str1, const char *str2);
 int determine_tabs_indent_method(const char *str);
 
+int utf8_char_len(const char *str, int len, int pos);
+int utf8_next(const char *str, int len, int pos);
+int utf8_prev(const char *str, int len, int pos);
+
 #endif /* UTIL_H_ */
@@ -0,0 +1,213 @@
+#include "watch.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "buffer.h"
+#include "mark.h"
+#include "minibuffer.h"
+#include "util.h"
+#include "trace.h"
+
+Uint32 watch_event = (Uint32)-1;
+
+static SDL_TimerID timer;
+
+/* Runs on SDL's timer thread. */
+static Uint32 watch_tick(Uint32 interval, void *param) {
+    SDL_Event event;
+    (void)param;
+    memset(&event, 0, sizeof(event));
+    event.type = watch_event;
+    SDL_PushEvent(&event);
+    return interval;
+}
+
+void watch_init() {
+    watch_event = SDL_RegisterEvents(1);
+    timer = SDL_AddTimer(WATCH_INTERVAL_MS, watch_tick, NULL);
+}
+
+void watch_quit() {
+    if (timer) SDL_RemoveTimer(timer);
+    timer = 0;
+}
+
+/* Takes the file as it is now as the version the buffer holds. */
+void watch_remember(struct Buffer *buf) {
+    struct stat st;
+    if (stat(buf->filename, &st) != 0) return;
+    if (st.st_ino != buf->file_ino) registry_update(buf); /* Written for the first time, or replaced. */
+    buf->file_mtime = st.st_mtime;
+    buf->file_size = st.st_size;
+}
+
+/* True if anything was reloaded or asked about, so needs drawing. */
+int watch_check() {
+    struct Buffer *buf;
+    struct stat st;
+    char msg[BUF_NAME_LEN + 16];
+    int changed = 0;
+
+    for (buf = headbuf; buf; buf = buf->next) {
+        if (!strlen(buf->filename) || buf->read_only || buf->session) continue;
+        if (stat(buf->filename, &st) != 0) continue; /* Gone for now; keep what we have. */
+        if (st.st_mtime == buf->file_mtime && st.st_size == buf->file_size) continue;
+
+        if (!buf->edited) {
+            changed = 1;
+            if (buffer_reload(buf) == 0 && curbuf != minibuf) {
+                sprintf(msg, "Reloaded %s.", buf->name);
+                minibuffer_message(msg);
+            }
+        } else if (buf == curbuf) {
+            /* Only asked once for each change, whatever the answer. Buffers
+             * that aren't current are asked when they are. */
+            buf->file_mtime = st.st_mtime;
+            buf->file_size = st.st_size;
+            changed = 1;
+            prevbuf = curbuf;
+            curbuf = minibuf;
+            minibuf->singular_state = STATE_RELOAD_FILE;
+            strcpy(minibuf->start_line->pre_str, "File changed on disk. Reload and discard changes? (y/n): ");
+        }
+    }
+    return changed;
+}
+
+/* Where a point was, by line number, so it can be found again after the
+ * lines it was on have been replaced. */
+struct SavedPoint {
+    int y, pos;
+};
+
+static void save_point(struct SavedPoint *saved, struct Point *p) {
+    saved->y = p->line ? p->line->y : 0;
+    saved->pos = p->pos;
+}
+
+/* Puts a point back, shifting it by the change in line count if it was
+ * after the replaced lines [first, old_end), which became [first, new_end). */
+static void restore_point(struct Buffer *buf, struct SavedPoint *saved, struct Point *p, int first, int old_end, int new_end) {
+    int y = saved->y;
+
+    if (y >= old_end) {
+        y += new_end - old_end;
+    } else if (y >= first && y >= new_end) {
+        y = new_end > first ? new_end-1 : first;
+    }
+    if (y >= buf->line_count) y = buf->line_count-1;
+
+    p->line = buffer_line_at(buf, y);
+    p->pos = saved->pos < p->line->len ? saved->pos : p->line->len;
+    p->pos = line_byte_at_col(p->line, line_visual_col(p->line, p->pos));
+}
+
+static bool line_equals(struct Line *line, const char *str, int len) {
+    return line->len == len && 0 == memcmp(line->str, str, len);
+}
+
+/* Reads the buffer's file again. The lines that are the same at the start
+ * and at the end are kept, and only the ones in between are replaced. */
+int buffer_reload(struct Buffer *buf) {
+    struct SavedPoint points[2], marks[2][2];
+    struct Line *line, *last;
+    struct Point start, end;
+    int *starts, count = 0, i, len, first, old_end, new_end, text_len;
+    char *text, *p;
+
+    text = buffer_read_file(buf->filename, &len);
+    if (!text) return 1;
+
+    trace_begin("buffer_reload");
+
+    /* Where each line starts, plus one past the end of the last. */
+    for (i = 0; i < len; i++) {
+        if (text[i] == '\n') count++;
+    }
+    count++;
+    starts = alloc(count+1, sizeof(int));
+    for (i = 0, count = 1; i < len; i++) {
+        if (text[i] == '\n') starts[count++] = i+1;
+    }
+    starts[count] = len+1;
+
+    /* Lines that didn't change at the start, then at the end. */
+    for (line = buf->start_line, first = 0; line && first < count; line = line->next, first++) {
+        if (!line_equals(line, text + starts[first], starts[first+1]-1 - starts[first])) break;
+    }
+    last = buffer_line_at(buf, buf->line_count-1);
+    old_end = buf->line_count;
+    new_end = count;
+    while (old_end > first && new_end > first &&
+           line_equals(last, text + starts[new_end-1], starts[new_end]-1 - starts[new_end-1])) {
+        last = last->prev;
+        old_end--;
+        new_end--;
+    }
+
+    if (first == old_end && first == new_end) {
+        /* Only the time changed, or the trailing newline. */
+        dealloc(starts);
+        dealloc(text);
+        buffer_set_edited(buf, false);
+        watch_remember(buf);
+        trace_end();
+        return 0;
+    }
+
+    for (i = 0; i < buf->view_count; i++) {
+        struct Mark *mark = buf->views[i].mark;
+        save_point(&points[i], &buf->views[i].point);
+        if (mark->active) {
+            save_point(&marks[i][0], mark->start);
+            save_point(&marks[i][1], mark->end);
+        }
+    }
+
+    /* Replace lines [first, old_end) with the new [first, new_end). When
+     * there are lines after them the region ends at the start of the next
+     * one, and otherwise it starts at the end of the line before. */
+    if (old_end < buf->line_count) {
+        start.line = buffer_line_at(buf, first);
+        start.pos = 0;
+        end.line = buffer_line_at(buf, old_end);
+        end.pos = 0;
+        p = text + starts[first];
+        text_len = starts[new_end] - starts[first];
+    } else if (first > 0) {
+        start.line = buffer_line_at(buf, first-1);
+        start.pos = start.line->len;
+        end.line = buffer_line_at(buf, old_end-1);
+        end.pos = end.line->len;
+        p = text + starts[first]-1;
+        text_len = len - (starts[first]-1);
+    } else {
+        start.line = buf->start_line;
+        start.pos = 0;
+        end.line = buffer_line_at(buf, old_end-1);
+        end.pos = end.line->len;
+        p = text;
+        text_len = len;
+    }
+
+    buffer_delete_region(buf, start, end);
+    buffer_insert_text(buf, p, text_len, false);
+
+    for (i = 0; i < buf->view_count; i++) {
+        struct Mark *mark = buf->views[i].mark;
+        restore_point(buf, &points[i], &buf->views[i].point, first, old_end, new_end);
+        if (mark->active) {
+            restore_point(buf, &marks[i][0], mark->start, first, old_end, new_end);
+            restore_point(buf, &marks[i][1], mark->end, first, old_end, new_end);
+        }
+    }
+
+    dealloc(starts);
+    dealloc(text);
+    buffer_set_edited(buf, false);
+    watch_remember(buf);
+    trace_end();
+    return 0;
+}
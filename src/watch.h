@@ -0,0 +1,26 @@
+#ifndef WATCH_H_
+#define WATCH_H_
+
+/* Notices when another program changes the file behind a buffer. There's
+   no portable way to be told, so a timer wakes the main loop up every
+   WATCH_INTERVAL_MS with a watch_event, and the files are stat'ed, which
+   is cheap next to reading them. A file that changed is diffed against
+   its buffer, and only the lines that differ are replaced, so point,
+   marks and scroll stay where they were. Buffers with unsaved changes
+   ask first. */
+
+#include <SDL2/SDL.h>
+
+#define WATCH_INTERVAL_MS 1000
+
+struct Buffer;
+
+extern Uint32 watch_event;
+
+void watch_init();
+void watch_quit();
+void watch_remember(struct Buffer *buf);
+int  watch_check();
+int  buffer_reload(struct Buffer *buf);
+
+#endif /* WATCH_H_ */
@@ -0,0 +1,255 @@
+#include "wrap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "globals.h"
+#include "buffer.h"
+#include "panel.h"
+#include "util.h"
+
+bool soft_wrap = false;
+
+/* Columns in a row, or 0 if buf isn't wrapped. Both panels are the same
+ * width, so the layout is the same whichever view it's drawn in. */
+int wrap_cols(struct Buffer *buf) {
+    int cols;
+    if (!soft_wrap || buf->is_singular) return 0;
+    cols = (window_width/panel_count() - SPACING*2) / font_w;
+    return cols > 0 ? cols : 1;
+}
+
+/* Rows line takes up. There's always room after the last column for the
+ * point, so a line that exactly fills a row gets another. */
+int line_rows(struct Line *line) {
+    int cols = wrap_cols(line->buf);
+    if (!cols) return 1;
+    if (line->wrap_cols != cols) {
+        line->wrap_rows = line_visual_col(line, line->len) / cols + 1;
+        line->wrap_cols = cols;
+    }
+    return line->wrap_rows;
+}
+
+/* Called when the text of line changes. */
+void wrap_line_changed(struct Line *line) {
+    struct WrapLayout *wrap = &line->buf->wrap;
+
+    line->wrap_cols = 0;
+    if (!wrap->cols || line->wrap_queued) return;
+    if (wrap->queue_count == wrap->queue_cap) {
+        wrap->queue_cap = wrap->queue_cap ? wrap->queue_cap*2 : 16;
+        wrap->queue = reallocate(wrap->queue, wrap->queue_cap * sizeof(struct Line *));
+    }
+    line->wrap_slot = wrap->queue_count;
+    wrap->queue[wrap->queue_count++] = line;
+    line->wrap_queued = true;
+}
+
+/* Called when every line is replaced, so the tree is built again. */
+void wrap_lines_changed(struct Buffer *buf) {
+    buf->wrap.cols = 0;
+    buf->wrap.queue_count = 0;
+}
+
+/* Called for a line that's about to be freed, so the queue can't be left
+ * pointing at it. */
+void wrap_forget_line(struct Line *line) {
+    struct WrapLayout *wrap = &line->buf->wrap;
+    struct Line *moved;
+
+    if (!line->wrap_queued) return;
+    line->wrap_queued = false;
+    if (line->wrap_slot >= wrap->queue_count || wrap->queue[line->wrap_slot] != line) return; /* Dropped with the queue. */
+
+    moved = wrap->queue[--wrap->queue_count];
+    wrap->queue[line->wrap_slot] = moved;
+    moved->wrap_slot = line->wrap_slot;
+}
+
+void wrap_free(struct WrapLayout *wrap) {
+    dealloc(wrap->tree);
+    dealloc(wrap->rows);
+    dealloc(wrap->queue);
+    wrap->tree = NULL;
+    wrap->rows = NULL;
+    wrap->queue = NULL;
+    wrap->count = wrap->cap = wrap->cols = 0;
+    wrap->queue_count = wrap->queue_cap = 0;
+}
+
+static void tree_add(struct WrapLayout *wrap, int y, int delta) {
+    int i;
+    for (i = y+1; i <= wrap->count; i += i & -i) wrap->tree[i] += delta;
+}
+
+/* Rows taken by the first n lines. */
+static int tree_prefix(struct WrapLayout *wrap, int n) {
+    int sum = 0;
+    for (; n > 0; n -= n & -n) sum += wrap->tree[n];
+    return sum;
+}
+
+static void wrap_reserve(struct WrapLayout *wrap, int count) {
+    if (count+1 <= wrap->cap) return;
+    wrap->cap = (count+1)*2;
+    wrap->tree = reallocate(wrap->tree, wrap->cap * sizeof(int));
+    wrap->rows = reallocate(wrap->rows, wrap->cap * sizeof(int));
+}
+
+/* Builds the nodes past y from the rows. The ones up to y only cover
+ * lines before it, so they stand, and those of them whose parent is past
+ * y are the ones a prefix sum of y visits. Each node adds itself to its
+ * parent, for O(n) instead of O(n log n). */
+static void tree_build_from(struct WrapLayout *wrap, int y) {
+    int i, parent;
+
+    wrap->tree[0] = 0;
+    for (i = y+1; i <= wrap->count; i++) wrap->tree[i] = wrap->rows[i-1];
+    for (i = y; i > 0; i -= i & -i) {
+        parent = i + (i & -i);
+        if (parent <= wrap->count) wrap->tree[parent] += wrap->tree[i];
+    }
+    for (i = y+1; i <= wrap->count; i++) {
+        parent = i + (i & -i);
+        if (parent <= wrap->count) wrap->tree[parent] += wrap->tree[i];
+    }
+}
+
+/* Whether the tree is kept up to date for buf. Once wrapping is turned
+ * off or the width changes it's dropped, to be built again when needed. */
+static bool wrap_tracking(struct Buffer *buf) {
+    if (!buf->wrap.cols) return false;
+    if (buf->wrap.cols == wrap_cols(buf)) return true;
+    wrap_lines_changed(buf);
+    return false;
+}
+
+/* Called once count lines starting at first have been linked in and the
+ * ones after renumbered. */
+void wrap_lines_inserted(struct Line *first, int count) {
+    struct WrapLayout *wrap = &first->buf->wrap;
+    int y = first->y, i;
+
+    if (!wrap_tracking(first->buf)) return;
+    wrap_reserve(wrap, wrap->count + count);
+    memmove(wrap->rows + y + count, wrap->rows + y, (wrap->count - y) * sizeof(int));
+    for (i = 0; i < count; i++, first = first->next) wrap->rows[y+i] = line_rows(first);
+    wrap->count += count;
+    tree_build_from(wrap, y);
+}
+
+/* Called once the count lines that were numbered from y are unlinked. */
+void wrap_lines_removed(struct Buffer *buf, int y, int count) {
+    struct WrapLayout *wrap = &buf->wrap;
+
+    if (!wrap_tracking(buf)) return;
+    memmove(wrap->rows + y, wrap->rows + y + count, (wrap->count - y - count) * sizeof(int));
+    wrap->count -= count;
+    tree_build_from(wrap, y);
+}
+
+/* Brings the tree up to date for the current width. */
+static void wrap_sync(struct Buffer *buf, int cols) {
+    struct WrapLayout *wrap = &buf->wrap;
+    struct Line *line;
+    int i;
+
+    if (wrap->cols != cols) {
+        wrap_reserve(wrap, buf->line_count);
+        wrap->count = buf->line_count;
+        for (line = buf->start_line, i = 0; line; line = line->next, i++) {
+            wrap->rows[i] = line_rows(line);
+            line->wrap_queued = false;
+        }
+        tree_build_from(wrap, 0);
+        wrap->queue_count = 0;
+        wrap->cols = cols;
+        return;
+    }
+
+    for (i = 0; i < wrap->queue_count; i++) {
+        int rows;
+        line = wrap->queue[i];
+        rows = line_rows(line);
+        tree_add(wrap, line->y, rows - wrap->rows[line->y]);
+        wrap->rows[line->y] = rows;
+        line->wrap_queued = false;
+    }
+    wrap->queue_count = 0;
+}
+
+/* Screen row that byte pos of line is drawn on, counting from the top
+ * of the buffer. */
+int line_row(struct Line *line, int pos) {
+    int cols = wrap_cols(line->buf);
+    if (!cols) return line->y;
+    wrap_sync(line->buf, cols);
+    return tree_prefix(&line->buf->wrap, line->y) + line_visual_col(line, pos) / cols;
+}
+
+/* Column that byte pos of line is drawn at within its row. */
+int line_row_col(struct Line *line, int pos) {
+    int cols = wrap_cols(line->buf);
+    return cols ? line_visual_col(line, pos) % cols : line_visual_col(line, pos);
+}
+
+int buffer_row_count(struct Buffer *buf) {
+    int cols = wrap_cols(buf);
+    if (!cols) return buf->line_count;
+    wrap_sync(buf, cols);
+    return tree_prefix(&buf->wrap, buf->wrap.count);
+}
+
+/* Line drawn on screen row row, with the row within the line in *sub.
+ * Rows past the end give the last row of the last line. */
+struct Line *buffer_row_line(struct Buffer *buf, int row, int *sub) {
+    struct WrapLayout *wrap = &buf->wrap;
+    struct Line *line;
+    int cols = wrap_cols(buf), y = 0, step;
+
+    if (row < 0) row = 0;
+    if (!cols) {
+        *sub = 0;
+        return buffer_line_at(buf, row);
+    }
+    wrap_sync(buf, cols);
+
+    /* Walk down the tree for the last line starting at or before row. */
+    for (step = 1; step*2 <= wrap->count; step *= 2);
+    for (; step; step /= 2) {
+        if (y+step <= wrap->count && wrap->tree[y+step] <= row) {
+            y += step;
+            row -= wrap->tree[y];
+        }
+    }
+    if (y == wrap->count) {
+        line = buf->lines[y-1];
+        *sub = line_rows(line)-1;
+        return line;
+    }
+    *sub = row;
+    return buf->lines[y];
+}
+
+/* Fills columns [first_col, last_col) of line, splitting the rectangle
+ * where the line wraps. x is where column 0 is drawn, and y the top of
+ * the line's first row. */
+void wrap_fill_cols(struct Line *line, int first_col, int last_col, int x, int y, int h) {
+    int cols = wrap_cols(line->buf);
+
+    if (!cols) {
+        SDL_Rect r = { x + first_col * font_w, y, (last_col - first_col) * font_w, h };
+        SDL_RenderFillRect(renderer, &r);
+        return;
+    }
+    while (first_col < last_col) {
+        int row = first_col / cols, end = (row+1) * cols;
+        SDL_Rect r = { x + (first_col - row*cols) * font_w, y + row * (font_h+SPACING), 0, h };
+
+        if (end > last_col) end = last_col;
+        r.w = (end - first_col) * font_w;
+        SDL_RenderFillRect(renderer, &r);
+        first_col = end;
+    }
+}
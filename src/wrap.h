@@ -0,0 +1,48 @@
+#ifndef WRAP_H_
+#define WRAP_H_
+
+#include <stdbool.h>
+
+/* Soft wrapping. When it's on, a line takes as many screen rows as its
+   text needs at the panel's width. Each line caches its row count along
+   with the width it was worked out for, and each buffer keeps a Fenwick
+   tree of the row counts by line number, so going between lines and
+   screen rows is O(log n). A row's line number is then looked up in the
+   buffer's array of lines, so it never walks the list.
+
+   Edited lines are queued and folded into the tree before the next
+   lookup. Adding or removing lines shifts the row counts past them and
+   rebuilds only the tree nodes that cover lines from there on, in the
+   same linear pass over the rest of the buffer that renumbering the lines
+   already takes. A new width rebuilds it all. */
+
+struct Line;
+struct Buffer;
+
+struct WrapLayout {
+    int *tree;               /* Fenwick tree of line_rows, indexed from 1. */
+    int *rows;               /* Each line's rows as the tree has them. */
+    int count, cap;          /* Lines in the tree. */
+    int cols;                /* Width the tree is for, or 0 if it has to be rebuilt. */
+    struct Line **queue;     /* Lines edited since, whose row counts may differ. */
+    int queue_count, queue_cap;
+};
+
+extern bool soft_wrap;
+
+int          wrap_cols(struct Buffer *buf);
+void         wrap_line_changed(struct Line *line);
+void         wrap_lines_changed(struct Buffer *buf);
+void         wrap_lines_inserted(struct Line *first, int count);
+void         wrap_lines_removed(struct Buffer *buf, int y, int count);
+void         wrap_forget_line(struct Line *line);
+void         wrap_free(struct WrapLayout *wrap);
+
+int          line_rows(struct Line *line);
+int          line_row(struct Line *line, int pos);
+int          line_row_col(struct Line *line, int pos);
+int          buffer_row_count(struct Buffer *buf);
+struct Line *buffer_row_line(struct Buffer *buf, int row, int *sub);
+void         wrap_fill_cols(struct Line *line, int first_col, int last_col, int x, int y, int h);
+
+#endif /* WRAP_H_ */